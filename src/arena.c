@@ -0,0 +1,97 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/arena.h"
+#include "include/print.h"
+
+static __thread struct arena thread_arena;
+
+struct arena* cmd_arena(void) {
+    return &thread_arena;
+}
+
+static struct arena_block* new_block(size_t min_size) {
+    size_t cap = min_size > ARENA_BLOCK_SIZE ? min_size : ARENA_BLOCK_SIZE;
+
+    struct arena_block* b = malloc(sizeof(*b) + cap);
+    if (!b)
+        return NULL;
+
+    b->next = NULL;
+    b->cap  = cap;
+    b->used = 0;
+    return b;
+}
+
+void* arena_alloc(struct arena* a, size_t size) {
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    struct arena_block* b = a->cur;
+    if (!b || b->cap - b->used < size) {
+        // blocks kept from before the last reset are reused before asking malloc for more
+        struct arena_block* next = b ? b->next : a->head;
+        if (next && next->cap >= size) {
+            next->used = 0;
+        }
+        else {
+            struct arena_block* fresh = new_block(size);
+            if (!fresh)
+                return NULL;
+
+            fresh->next = next;
+            if (b)
+                b->next = fresh;
+            else
+                a->head = fresh;
+
+            a->capacity += fresh->cap;
+            a->n_blocks++;
+            next = fresh;
+        }
+        a->cur = b = next;
+    }
+
+    void* p = b->data + b->used;
+    b->used += size;
+
+    a->used += size;
+    if (a->used > a->high_water)
+        a->high_water = a->used;
+
+    return p;
+}
+
+char* arena_strdup(struct arena* a, const char* s) {
+    size_t len = str_len(s);
+    char* out  = arena_alloc(a, len + 1);
+    if (out)
+        memcpy(out, s, len + 1);
+    return out;
+}
+
+void arena_reset(struct arena* a) {
+    a->cur  = a->head;
+    a->used = 0;
+    if (a->head)
+        a->head->used = 0;
+}
+
+void arena_release(struct arena* a) {
+    struct arena_block* b = a->head;
+    while (b) {
+        struct arena_block* next = b->next;
+        free(b);
+        b = next;
+    }
+
+    a->head     = NULL;
+    a->cur      = NULL;
+    a->used     = 0;
+    a->capacity = 0;
+    a->n_blocks = 0;
+}
+
+struct arena_stats arena_get_stats(const struct arena* a) {
+    struct arena_stats stats = {a->used, a->high_water, a->capacity, a->n_blocks};
+    return stats;
+}
@@ -1,10 +1,17 @@
+#include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <syscall.h>
 #include <unistd.h>
 
+#include "include/arena.h"
 #include "include/command.h"
+#include "include/input.h"
 #include "include/print.h"
 #include "include/tokenize.h"
 
@@ -19,6 +26,10 @@ struct builtin builtins[] = {
     {"mkdir", builtin_mkdir},
     {"touch", builtin_touch},
     {"cat", builtin_cat},
+    {"wc", builtin_wc},
+    {"head", builtin_head},
+    {"tail", builtin_tail},
+    {"sort", builtin_sort},
     {NULL, NULL},
 };
 
@@ -33,14 +44,13 @@ int builtin_pwd(int argc, char* argv[]) {
     (void)argc;
     (void)argv;
 
-    char* cwd = getcwd(NULL, 0);
-    if (!cwd) {
-        print("pwd: error getting current directory\n");
+    char* cwd = arena_alloc(cmd_arena(), PATH_MAX);
+    if (!cwd || !getcwd(cwd, PATH_MAX)) {
+        print_err("pwd: error getting current directory\n");
         return 0;
     }
     print("%s\n", cwd);
 
-    free(cwd);
     return 0;
 }
 
@@ -49,8 +59,7 @@ int builtin_echo(int argc, char* argv[]) {
         return 0;
 
     for (int idx = 1; idx < argc; idx++) {
-        print(argv[idx]);
-        print(" ");
+        print("%s ", argv[idx]);
     }
     print("\n");
 
@@ -59,8 +68,8 @@ int builtin_echo(int argc, char* argv[]) {
 
 int builtin_mkdir(int argc, char* argv[]) {
     if (argc <= 1) {
-        print("mkdir: missing operand\n");
-        print("usage: mkdir <directory-name>\n");
+        print_err("mkdir: missing operand\n");
+        print_err("usage: mkdir <directory-name>\n");
         return 0;
     }
 
@@ -68,7 +77,7 @@ int builtin_mkdir(int argc, char* argv[]) {
 
     int mkdir_ret = mkdir(argv[1], target_mode);
     if (mkdir_ret != 0) {
-        print("mkdir error: return value (%d)\n", mkdir_ret);
+        print_err("mkdir error: return value (%d)\n", mkdir_ret);
         return 0;
     }
 
@@ -82,14 +91,14 @@ int create_file(const char* file_path) {
 
     int open_ret = open(file_path, O_CREAT | O_WRONLY, init_mode);
     if (open_ret == -1) {
-        print("error creating file: %s\n", file_path);
+        print_err("error creating file: %s\n", file_path);
         return -1;
     }
     close(open_ret);
 
     int chmod_ret = chmod(file_path, target_mode);
     if (chmod_ret != 0) {
-        print("chmod error: return value (%d)\n", chmod_ret);
+        print_err("chmod error: return value (%d)\n", chmod_ret);
         return -1;
     }
 
@@ -99,8 +108,8 @@ int create_file(const char* file_path) {
 
 int builtin_touch(int argc, char* argv[]) {
     if (argc <= 1) {
-        print("touch: missing operand\n");
-        print("usage: touch <file-name>\n");
+        print_err("touch: missing operand\n");
+        print_err("usage: touch <file-name>\n");
         return 0;
     }
 
@@ -114,82 +123,15 @@ int file_exists(const char* file_path) {
     return stat(file_path, &buf) == 0;
 }
 
-int builtin_cp(int argc, char* argv[]) {
-    if (argc == 1) {
-        print("cp: missing source file\n");
-        print("usage: cp <source-file> <destination-file>\n");
-        return 0;
-    }
-    if (argc == 2) {
-        print("cp: missing file destination\n");
-        print("usage: cp <source-file> <destination-file>\n");
-        return 0;
-    }
-
-    const char* src_path = argv[1];
-    const char* dst_path = argv[2];
-
-    if (!file_exists(src_path)) {
-        print("cp: cannot copy %s, no such file\n", src_path);
-        return 0;
-    }
-    if (file_exists(dst_path)) {
-        print("cp: file: %s already exists\n", dst_path);
-        return 0;
-    }
-
-    if (create_file(dst_path) != 0)
-        return 0;
-
-    print("copying file ...\n");
-
-    const int src_fd = open(src_path, O_RDONLY);
-    if (src_fd == -1) {
-        print("error open source file: %s\n", src_path);
-        return 0;
-    }
-
-    const int dst_fd = open(dst_path, O_WRONLY);
-    if (dst_fd == -1) {
-        print("error open destination file: %s\n", dst_path);
-        close(src_fd);
-        return 0;
-    }
-
-    const size_t buf_size = 256;
-
-    char buf[buf_size];
-    ssize_t bytes_read;
-
-    while (1) {
-        bytes_read = read(src_fd, buf, buf_size);
-        if (bytes_read > 0) {
-            write(dst_fd, buf, bytes_read);
-        }
-        else if (bytes_read == 0) {
-            break;
-        }
-        else {
-            print("cp: error while reading %s\n", src_path);
-            break;
-        }
-    }
-
-    close(src_fd);
-    close(dst_fd);
-
-    return 0;
-}
-
 int builtin_cat(int argc, char* argv[]) {
     if (argc == 1) {
-        print("cat: missing file operand\n");
-        print("usage: cat <filename>\n");
+        print_err("cat: missing file operand\n");
+        print_err("usage: cat <filename>\n");
         return 0;
     }
     if (argc > 2) {
-        print("cat: too many arguments\n");
-        print("usage: cat <filename>\n");
+        print_err("cat: too many arguments\n");
+        print_err("usage: cat <filename>\n");
         return 0;
     }
 
@@ -198,18 +140,18 @@ int builtin_cat(int argc, char* argv[]) {
     int stat_ret = stat(file_path, &stat_buf);
 
     if (stat_ret != 0) {
-        print("cat: no such file: %s\n", file_path);
+        print_err("cat: no such file: %s\n", file_path);
         return 0;
     }
 
     if (!S_ISREG(stat_buf.st_mode)) {
-        print("error: %s is not a file\n", file_path);
+        print_err("error: %s is not a file\n", file_path);
         return 0;
     }
 
-    int fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        print("cat: cannot open file: %s\n", file_path);
+    struct input in;
+    if (input_open(&in, file_path) != 0) {
+        print_err("cat: cannot open file: %s\n", file_path);
         return 0;
     }
 
@@ -228,32 +170,23 @@ int builtin_cat(int argc, char* argv[]) {
     }
     print("\n");
 
-    const size_t buf_size = 256;
-    char buf[buf_size];
+    const char* data;
     ssize_t bytes_read;
 
     int line = 1;
-    print("%s   %d%s │", START_CYAN, line, END_COLOR);
-
-    while ((bytes_read = read(fd, buf, buf_size)) > 0) {
-        for (int i = 0; i < bytes_read; i++) {
-            char c = buf[i];
-            if (c == '\n') {
-                line++;
-                print("\n");
-                if (line < 10)
-                    print("%s   %d%s │", START_CYAN, line, END_COLOR);
-                else if (line < 100)
-                    print("%s  %d%s │", START_CYAN, line, END_COLOR);
-                else if (line < 1000)
-                    print("%s %d%s │", START_CYAN, line, END_COLOR);
-                else
-                    print("%s%d%s │", START_CYAN, line, END_COLOR);
-            }
-            else {
-                print("%c", c);
-            }
+    print("%s%4d%s │", START_CYAN, line, END_COLOR);
+
+    while ((bytes_read = input_next(&in, &data)) > 0) {
+        // write each run of text up to a newline in one call instead of char by char
+        const char* start = data;
+        const char* end   = data + bytes_read;
+        const char* nl;
+        while ((nl = memchr(start, '\n', end - start)) != NULL) {
+            line++;
+            print("%.*s\n%s%4d%s │", (int)(nl - start), start, START_CYAN, line, END_COLOR);
+            start = nl + 1;
         }
+        print_bytes(start, end - start);
     }
     print("\n");
     print("─────┴");
@@ -263,10 +196,10 @@ int builtin_cat(int argc, char* argv[]) {
     print("\n");
 
     if (bytes_read < 0) {
-        print("cat: error reading file: %s\n", file_path);
+        print_err("cat: error reading file: %s\n", file_path);
     }
 
-    close(fd);
+    input_close(&in);
     return 0;
 }
 
@@ -278,15 +211,47 @@ int builtin_exit(int argc, char* argv[]) {
 
 int run_builtin(int argc, char* argv[]) {
     for (int i = 0; builtins[i].name != NULL; i++) {
-        if (str_cmp(argv[0], builtins[i].name))
-            return builtins[i].func(argc, argv);
+        if (str_cmp(argv[0], builtins[i].name)) {
+            int ret = builtins[i].func(argc, argv);
+            arena_reset(cmd_arena()); // drop everything the command allocated in one go
+            return ret;
+        }
     }
 
     return -1;
 }
 
-void run_external(int argc, char* argv[]) {
+int run_external(int argc, char* argv[]) {
     (void)argc;
-    (void)argv;
-    // TODO: write this
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        print_err("%s: fork failed\n", argv[0]);
+        return -1;
+    }
+
+    if (pid == 0) {
+        // route the child's output to wherever print() is currently going
+        if (print_out_fd() != STDOUT_FILENO)
+            dup2(print_out_fd(), STDOUT_FILENO);
+        if (print_err_fd() != STDERR_FILENO)
+            dup2(print_err_fd(), STDERR_FILENO);
+
+        // the server ignores SIGPIPE for its sockets, commands must not inherit that
+        signal(SIGPIPE, SIG_DFL);
+
+        execvp(argv[0], argv);
+        print_err("%s: command not found\n", argv[0]);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    return 128 + WTERMSIG(status);
 }
@@ -0,0 +1,647 @@
+#define _GNU_SOURCE // copy_file_range
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/arena.h"
+#include "include/command.h"
+#include "include/input.h"
+#include "include/path.h"
+#include "include/print.h"
+#include "include/tokenize.h"
+
+#define CP_MAX_WORKERS 16
+#define CP_COPY_BUF    (128 * 1024)
+#define CP_UNCHANGED   (-2) // --update found nothing to do
+
+struct cp_flags {
+    int recurse;
+    int preserve;
+    int update;
+    int src_idx;
+};
+
+// a file or symlink to create, found while walking the tree and copied later by a worker
+struct cp_job {
+    const char* src;
+    const char* dst;
+    int is_link;
+};
+
+// a created directory whose final mode/times are applied once everything inside it is written
+struct cp_dir {
+    const char* dst;
+    struct stat st;
+};
+
+struct cp_tree {
+    const struct cp_flags* flags;
+    struct cp_job* jobs;
+    size_t n_jobs;
+    size_t jobs_cap;
+    struct cp_dir* dirs;
+    size_t n_dirs;
+    size_t dirs_cap;
+    dev_t top_dev; // the destination root, so copying a directory into itself doesn't recurse forever
+    ino_t top_ino;
+    size_t errors;
+};
+
+// shared by the workers, which pull jobs off the array with an atomic cursor
+struct cp_run {
+    const struct cp_tree* tree;
+    size_t next;
+    size_t files;
+    size_t bytes;
+    size_t unchanged;
+    size_t errors;
+    int out_fd;
+    int err_fd;
+};
+
+static struct cp_flags parse_cp_flags(int argc, char* argv[]) {
+    struct cp_flags flags = {0, 0, 0, 1};
+
+    while (flags.src_idx < argc && argv[flags.src_idx][0] == '-') {
+        const char* flag = argv[flags.src_idx] + 1;
+
+        if (str_cmp(flag, "-update")) {
+            flags.update = 1;
+            flags.src_idx++;
+            continue;
+        }
+
+        for (int i = 0; flag[i] != '\0'; i++) {
+            if (flag[i] == 'r' || flag[i] == 'R') {
+                flags.recurse = 1;
+            }
+            else if (flag[i] == 'p') {
+                flags.preserve = 1;
+            }
+            else if (flag[i] == 'u') {
+                flags.update = 1;
+            }
+            else {
+                print_err("cp: unknown flag -%c\n", flag[i]);
+                flags.src_idx = -1;
+                return flags;
+            }
+        }
+        flags.src_idx++;
+    }
+
+    return flags;
+}
+
+static void* grow(void* arr, size_t* cap, size_t elem_size) {
+    size_t new_cap = *cap ? *cap * 2 : 64;
+    void* grown    = realloc(arr, new_cap * elem_size);
+    if (grown)
+        *cap = new_cap;
+    return grown;
+}
+
+static int add_job(struct cp_tree* tree, const char* src, const char* dst, int is_link) {
+    if (tree->n_jobs == tree->jobs_cap) {
+        struct cp_job* grown = grow(tree->jobs, &tree->jobs_cap, sizeof(*grown));
+        if (!grown)
+            return -1;
+        tree->jobs = grown;
+    }
+
+    struct cp_job* job = &tree->jobs[tree->n_jobs];
+    job->src           = arena_strdup(cmd_arena(), src);
+    job->dst           = arena_strdup(cmd_arena(), dst);
+    job->is_link       = is_link;
+    if (!job->src || !job->dst)
+        return -1;
+
+    tree->n_jobs++;
+    return 0;
+}
+
+/*
+ * creates dst writable by us whatever the source mode is, the real mode is set at the end.
+ * with --update a directory left by an earlier copy is reused
+ */
+static int make_dir(struct cp_tree* tree, const char* dst, const struct stat* st) {
+    const mode_t mode = (st->st_mode & 0777) | 0700;
+
+    if (mkdir(dst, mode) != 0) {
+        struct stat existing;
+        if (errno != EEXIST || !tree->flags->update || stat(dst, &existing) != 0 || !S_ISDIR(existing.st_mode)) {
+            print_err("cp: cannot create directory %s: %s\n", dst, strerror(errno));
+            return -1;
+        }
+        if ((existing.st_mode & 0700) != 0700 && chmod(dst, existing.st_mode | 0700) != 0) {
+            print_err("cp: cannot write into directory %s: %s\n", dst, strerror(errno));
+            return -1;
+        }
+    }
+
+    if (tree->n_dirs == tree->dirs_cap) {
+        struct cp_dir* grown = grow(tree->dirs, &tree->dirs_cap, sizeof(*grown));
+        if (!grown)
+            return -1;
+        tree->dirs = grown;
+    }
+
+    struct cp_dir* dir = &tree->dirs[tree->n_dirs];
+    dir->dst           = arena_strdup(cmd_arena(), dst);
+    dir->st            = *st;
+    if (!dir->dst)
+        return -1;
+
+    tree->n_dirs++;
+    return 0;
+}
+
+static void walk_tree(struct cp_tree* tree, struct path_buf* src, struct path_buf* dst);
+
+// one directory entry, with src and dst already pointing at it
+static void visit_entry(struct cp_tree* tree, struct path_buf* src, struct path_buf* dst, char d_type) {
+    struct stat st;
+    if (d_type == DT_UNKNOWN || d_type == DT_DIR) {
+        if (lstat(src->data, &st) != 0) {
+            print_err("cp: cannot stat %s: %s\n", src->data, strerror(errno));
+            tree->errors++;
+            return;
+        }
+        d_type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : 0;
+    }
+
+    // without -p a symlink stands for what it points at; linked directories are skipped
+    if (d_type == DT_LNK && !tree->flags->preserve) {
+        if (stat(src->data, &st) != 0) {
+            print_err("cp: cannot follow symlink %s: %s\n", src->data, strerror(errno));
+            tree->errors++;
+            return;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            print_err("cp: skipping symlinked directory %s\n", src->data);
+            return;
+        }
+        d_type = S_ISREG(st.st_mode) ? DT_REG : 0;
+    }
+
+    if (d_type == DT_DIR) {
+        if (st.st_dev == tree->top_dev && st.st_ino == tree->top_ino)
+            return;
+        if (make_dir(tree, dst->data, &st) != 0) {
+            tree->errors++;
+            return;
+        }
+        walk_tree(tree, src, dst);
+    }
+    else if (d_type == DT_REG || d_type == DT_LNK) {
+        if (add_job(tree, src->data, dst->data, d_type == DT_LNK) != 0) {
+            print_err("cp: out of memory queueing %s\n", src->data);
+            tree->errors++;
+        }
+    }
+    else {
+        print_err("cp: skipping special file %s\n", src->data);
+    }
+}
+
+/*
+ * walks src, creating the matching directories under dst as it goes and queueing
+ * every file and symlink. nothing is copied yet, so the whole skeleton exists
+ * before the workers start
+ */
+static void walk_tree(struct cp_tree* tree, struct path_buf* src, struct path_buf* dst) {
+    const int dir_fd = open(src->data, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd < 0) {
+        print_err("cp: cannot open directory %s: %s\n", src->data, strerror(errno));
+        tree->errors++;
+        return;
+    }
+
+    char buf[4096];
+    int n_read;
+    while ((n_read = get_dirents(dir_fd, buf, sizeof(buf))) > 0) {
+        for (int idx = 0; idx < n_read;) {
+            struct linux_dirent* d = (struct linux_dirent*)(buf + idx);
+            char d_type            = buf[idx + d->d_reclen - 1];
+            idx += d->d_reclen;
+
+            if (str_cmp(d->d_name, ".") || str_cmp(d->d_name, ".."))
+                continue;
+
+            const size_t src_len = path_push(src, d->d_name);
+            const size_t dst_len = path_push(dst, d->d_name);
+            if (src_len == PATH_PUSH_FAILED || dst_len == PATH_PUSH_FAILED) {
+                print_err("cp: out of memory building path under %s\n", src->data);
+                tree->errors++;
+            }
+            else {
+                visit_entry(tree, src, dst, d_type);
+            }
+
+            if (src_len != PATH_PUSH_FAILED)
+                path_pop(src, src_len);
+            if (dst_len != PATH_PUSH_FAILED)
+                path_pop(dst, dst_len);
+        }
+    }
+
+    if (n_read < 0) {
+        print_err("cp: cannot read directory %s: %s\n", src->data, strerror(errno));
+        tree->errors++;
+    }
+
+    close(dir_fd);
+}
+
+// copies in the kernel where the filesystem allows it, read/write otherwise; returns bytes or -1
+static ssize_t copy_data(int src_fd, int dst_fd, size_t size, char** buf) {
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = copy_file_range(src_fd, NULL, dst_fd, NULL, size - done, 0);
+        if (n > 0) {
+            done += n;
+            continue;
+        }
+        if (n == 0)
+            return done;
+        if (errno == EINTR)
+            continue;
+        if (done == 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP))
+            break;
+        return -1;
+    }
+
+    if (done == size)
+        return done;
+
+    if (!*buf && !(*buf = malloc(2 * CP_COPY_BUF)))
+        return -1;
+
+    ssize_t n;
+    while ((n = read(src_fd, *buf, CP_COPY_BUF)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (ssize_t off = 0; off < n;) {
+            ssize_t w = write(dst_fd, *buf + off, n - off);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+            off += w;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+static int pwrite_full(int fd, const char* buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+/*
+ * brings an existing dst in line with src block by block: a block is only written
+ * when it differs, then dst is cut to src's length. both blocks are already in
+ * memory, so they're compared directly rather than hashed. returns bytes written
+ */
+static ssize_t sync_data(int src_fd, int dst_fd, size_t size, size_t dst_size, char** buf) {
+    if (!*buf && !(*buf = malloc(2 * CP_COPY_BUF)))
+        return -1;
+
+    char* src_block = *buf;
+    char* dst_block = *buf + CP_COPY_BUF;
+    size_t written  = 0;
+
+    for (size_t off = 0; off < size; off += CP_COPY_BUF) {
+        size_t n = size - off < CP_COPY_BUF ? size - off : CP_COPY_BUF;
+        if (pread_all(src_fd, src_block, n, off) != 0)
+            return -1;
+
+        int same = off + n <= dst_size && pread_all(dst_fd, dst_block, n, off) == 0 &&
+                   memcmp(src_block, dst_block, n) == 0;
+        if (same)
+            continue;
+
+        if (pwrite_full(dst_fd, src_block, n, off) != 0)
+            return -1;
+        written += n;
+    }
+
+    if (dst_size > size && ftruncate(dst_fd, size) != 0)
+        return -1;
+
+    return written;
+}
+
+// returns bytes written, CP_UNCHANGED if --update found dst already matching, -1 on error
+static ssize_t copy_file(const char* src, const char* dst, const struct cp_flags* flags, char** buf) {
+    int src_fd = open(src, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (src_fd < 0 || fstat(src_fd, &st) != 0) {
+        print_err("cp: cannot open %s: %s\n", src, strerror(errno));
+        if (src_fd >= 0)
+            close(src_fd);
+        return -1;
+    }
+
+    // same size and mtime is taken to mean same contents, like rsync's quick check
+    struct stat dst_st;
+    int exists = flags->update && lstat(dst, &dst_st) == 0;
+    if (exists && !S_ISREG(dst_st.st_mode)) {
+        print_err("cp: cannot update %s: not a regular file\n", dst);
+        close(src_fd);
+        return -1;
+    }
+    if (exists && dst_st.st_size == st.st_size && dst_st.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+        dst_st.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+        close(src_fd);
+        return CP_UNCHANGED;
+    }
+
+    int dst_fd = exists ? open(dst, O_RDWR | O_CLOEXEC)
+                        : open(dst, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, st.st_mode & 0777);
+    if (dst_fd < 0) {
+        print_err("cp: cannot %s %s: %s\n", exists ? "open" : "create", dst, strerror(errno));
+        close(src_fd);
+        return -1;
+    }
+
+    ssize_t copied = exists ? sync_data(src_fd, dst_fd, st.st_size, dst_st.st_size, buf)
+                            : copy_data(src_fd, dst_fd, st.st_size, buf);
+    if (copied < 0)
+        print_err("cp: error copying %s: %s\n", src, strerror(errno));
+
+    // --update always carries the mtime over, it's what lets the next run skip the file
+    if (copied >= 0 && (flags->preserve || flags->update)) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        if (!flags->preserve)
+            times[0].tv_nsec = UTIME_OMIT;
+        if ((flags->preserve && fchmod(dst_fd, st.st_mode & 07777) != 0) || futimens(dst_fd, times) != 0)
+            print_err("cp: cannot preserve attributes of %s: %s\n", dst, strerror(errno));
+    }
+
+    close(src_fd);
+    if (close(dst_fd) != 0 && copied >= 0) {
+        print_err("cp: error writing %s: %s\n", dst, strerror(errno));
+        copied = -1;
+    }
+
+    return copied;
+}
+
+// only reached with -p, otherwise symlinks were resolved during the walk
+static ssize_t copy_symlink(const char* src, const char* dst, int update) {
+    char target[PATH_MAX];
+    ssize_t len = readlink(src, target, sizeof(target) - 1);
+    if (len < 0) {
+        print_err("cp: cannot read symlink %s: %s\n", src, strerror(errno));
+        return -1;
+    }
+    target[len] = '\0';
+
+    struct stat dst_st;
+    if (update && lstat(dst, &dst_st) == 0) {
+        char current[PATH_MAX];
+        ssize_t cur_len = S_ISLNK(dst_st.st_mode) ? readlink(dst, current, sizeof(current)) : -1;
+        if (cur_len == len && memcmp(current, target, len) == 0)
+            return CP_UNCHANGED;
+
+        if (S_ISDIR(dst_st.st_mode) || unlink(dst) != 0) {
+            print_err("cp: cannot replace %s with a symlink\n", dst);
+            return -1;
+        }
+    }
+
+    if (symlink(target, dst) != 0) {
+        print_err("cp: cannot create symlink %s: %s\n", dst, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (lstat(src, &st) == 0) {
+        struct timespec times[2] = {st.st_atim, st.st_mtim};
+        utimensat(AT_FDCWD, dst, times, AT_SYMLINK_NOFOLLOW);
+    }
+
+    return 0;
+}
+
+static void* cp_worker(void* arg) {
+    struct cp_run* run           = arg;
+    const struct cp_tree* tree   = run->tree;
+    char* buf                    = NULL;
+
+    // workers report through the same output as the command that started them
+    print_set_output(run->out_fd, run->err_fd);
+
+    size_t i;
+    while ((i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED)) < tree->n_jobs) {
+        const struct cp_job* job = &tree->jobs[i];
+
+        ssize_t copied = job->is_link ? copy_symlink(job->src, job->dst, tree->flags->update)
+                                      : copy_file(job->src, job->dst, tree->flags, &buf);
+        if (copied == CP_UNCHANGED) {
+            __atomic_fetch_add(&run->unchanged, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        if (copied < 0) {
+            __atomic_fetch_add(&run->errors, 1, __ATOMIC_RELAXED);
+            continue;
+        }
+        __atomic_fetch_add(&run->files, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&run->bytes, (size_t)copied, __ATOMIC_RELAXED);
+    }
+
+    free(buf);
+    return NULL;
+}
+
+// small files are all latency (open, create, close), so more threads than cpus still pays off
+static void run_workers(struct cp_run* run) {
+    long n_cpus   = sysconf(_SC_NPROCESSORS_ONLN);
+    long n_thread = n_cpus < 1 ? 4 : n_cpus * 2;
+    if (n_thread > CP_MAX_WORKERS)
+        n_thread = CP_MAX_WORKERS;
+    if ((size_t)n_thread > run->tree->n_jobs)
+        n_thread = run->tree->n_jobs;
+
+    pthread_t threads[CP_MAX_WORKERS];
+    int started[CP_MAX_WORKERS];
+
+    for (long i = 1; i < n_thread; i++)
+        started[i] = pthread_create(&threads[i], NULL, cp_worker, run) == 0;
+
+    cp_worker(run);
+    for (long i = 1; i < n_thread; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+}
+
+// children first, so setting a parent read-only never blocks work inside it
+static void finish_dirs(const struct cp_tree* tree) {
+    for (size_t i = tree->n_dirs; i-- > 0;) {
+        const struct cp_dir* dir = &tree->dirs[i];
+
+        if (tree->flags->preserve) {
+            struct timespec times[2] = {dir->st.st_atim, dir->st.st_mtim};
+            if (chmod(dir->dst, dir->st.st_mode & 07777) != 0 || utimensat(AT_FDCWD, dir->dst, times, 0) != 0)
+                print_err("cp: cannot preserve attributes of %s: %s\n", dir->dst, strerror(errno));
+        }
+        else if ((dir->st.st_mode & 0700) != 0700) {
+            chmod(dir->dst, dir->st.st_mode & 0777);
+        }
+    }
+}
+
+static double elapsed_since(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void copy_tree(const char* src_path, const char* dst_path, const struct cp_flags* flags,
+                      const struct stat* src_st) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct cp_tree tree;
+    memset(&tree, 0, sizeof(tree));
+    tree.flags = flags;
+
+    struct path_buf src;
+    struct path_buf dst;
+    if (path_init(&src, src_path) != 0 || path_init(&dst, dst_path) != 0) {
+        print_err("cp: out of memory\n");
+        path_free(&src);
+        return;
+    }
+
+    struct stat top;
+    if (make_dir(&tree, dst.data, src_st) == 0 && stat(dst.data, &top) == 0) {
+        tree.top_dev = top.st_dev;
+        tree.top_ino = top.st_ino;
+        walk_tree(&tree, &src, &dst);
+
+        struct cp_run run = {&tree, 0, 0, 0, 0, 0, print_out_fd(), print_err_fd()};
+        if (tree.n_jobs > 0)
+            run_workers(&run);
+        finish_dirs(&tree);
+
+        double secs = elapsed_since(&start);
+        if (secs <= 0)
+            secs = 1e-9;
+        print("cp: copied %zu files, %zu bytes in %.3fs (%.0f files/s, %.1f MiB/s)\n", run.files, run.bytes, secs,
+              run.files / secs, run.bytes / secs / (1024 * 1024));
+
+        if (flags->update)
+            print("cp: %zu files already up to date\n", run.unchanged);
+
+        size_t errors = tree.errors + run.errors;
+        if (errors > 0)
+            print_err("cp: %zu error%s, see above\n", errors, errors == 1 ? "" : "s");
+    }
+
+    free(tree.jobs);
+    free(tree.dirs);
+    path_free(&src);
+    path_free(&dst);
+}
+
+// the final path component of path, ignoring trailing slashes
+static const char* base_name(const char* path) {
+    char* copy = arena_strdup(cmd_arena(), path);
+    if (!copy)
+        return path;
+
+    size_t len = str_len(copy);
+    while (len > 1 && copy[len - 1] == '/')
+        copy[--len] = '\0';
+
+    char* slash = strrchr(copy, '/');
+    return slash && slash[1] != '\0' ? slash + 1 : copy;
+}
+
+int builtin_cp(int argc, char* argv[]) {
+    struct cp_flags flags = parse_cp_flags(argc, argv);
+    if (flags.src_idx < 0 || flags.src_idx + 2 != argc) {
+        print_err("usage: cp [-r] [-p] [-u|--update] <source> <destination>\n");
+        return 0;
+    }
+
+    const char* src_path = argv[flags.src_idx];
+    const char* dst_path = argv[flags.src_idx + 1];
+
+    struct stat src_st;
+    if (stat(src_path, &src_st) != 0) {
+        print_err("cp: cannot copy %s, no such file\n", src_path);
+        return 0;
+    }
+    if (S_ISDIR(src_st.st_mode) && !flags.recurse) {
+        print_err("cp: %s is a directory (use -r)\n", src_path);
+        return 0;
+    }
+
+    /*
+     * copying onto an existing directory puts the source inside it. with --update a
+     * source ending in '/' (as with rsync) syncs its contents into the directory itself
+     */
+    size_t src_len    = str_len(src_path);
+    int contents_only = flags.update && S_ISDIR(src_st.st_mode) && src_path[src_len - 1] == '/';
+
+    struct stat dst_st;
+    if (!contents_only && stat(dst_path, &dst_st) == 0 && S_ISDIR(dst_st.st_mode)) {
+        struct path_buf inside;
+        if (path_init(&inside, dst_path) != 0 || path_push(&inside, base_name(src_path)) == PATH_PUSH_FAILED) {
+            print_err("cp: out of memory\n");
+            path_free(&inside);
+            return 0;
+        }
+        dst_path = arena_strdup(cmd_arena(), inside.data);
+        path_free(&inside);
+        if (!dst_path) {
+            print_err("cp: out of memory\n");
+            return 0;
+        }
+    }
+
+    if (!flags.update && file_exists(dst_path)) {
+        print_err("cp: file: %s already exists\n", dst_path);
+        return 0;
+    }
+
+    if (S_ISDIR(src_st.st_mode)) {
+        copy_tree(src_path, dst_path, &flags, &src_st);
+        return 0;
+    }
+
+    char* buf = NULL;
+    if (copy_file(src_path, dst_path, &flags, &buf) == CP_UNCHANGED)
+        print("cp: %s is up to date\n", dst_path);
+    free(buf);
+
+    return 0;
+}
@@ -1,22 +1,56 @@
 #include "include/command.h"
+#include "include/ignore.h"
+#include "include/input.h"
+#include "include/path.h"
 #include "include/print.h"
 #include "include/tokenize.h"
 
+#include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 
-#define BUF_SIZE 256
-#define MAX_LINE_LEN 512
+#define BINARY_PROBE_LEN 8192
+#define MAX_CONTEXT 100000
+
+enum binary_mode {
+    BINARY_REPORT,  // say "Binary file ... matches" instead of printing lines
+    BINARY_TEXT,    // search it like any other file (-a)
+    BINARY_SKIP,    // pretend it doesn't match (--binary-files=without-match)
+};
 
 struct grep_flags {
     int ignore_case;
     int print_lines;
     int help;
     int recurse;
+    enum binary_mode binary;
+    long before; // -B lines of leading context, -1 if not asked for
+    long after;  // -A lines of trailing context, -1 if not asked for
     int pattern_idx;
 };
 
+// a line inside the current buffer, kept by offset so the buffer can move underneath it
+struct line_span {
+    size_t off;
+    size_t len;
+    long number;
+};
+
+struct grep_scan {
+    const char* path;
+    const char* pattern;
+    const struct grep_flags* flags;
+    struct line_span* ring; // last `before` unprinted lines, oldest at ring[head]
+    long head;
+    long count;
+    long after_left;   // trailing context lines still owed to the last match
+    long last_printed; // line number of the last line printed, 0 if none yet
+    long line_number;
+    int is_binary;
+    int done;
+};
+
 int get_dirents(const int path_fd, const char buf[], const int buf_size) {
     int n_read = syscall(SYS_getdents, path_fd, buf, buf_size);
     return n_read;
@@ -28,11 +62,11 @@ char to_lower(char c) {
     return c;
 }
 
-int substrings_match_caseless(const char* txt, const char* pattern) {
-    for (int i = 0; txt[i] != '\0'; i++) {
-        int j = 0;
+int substrings_match_caseless(const char* txt, size_t len, const char* pattern) {
+    for (size_t i = 0; i < len; i++) {
+        size_t j = 0;
 
-        while (pattern[j] != '\0' && txt[i + j] != '\0' && to_lower(txt[i + j]) == to_lower(pattern[j])) {
+        while (pattern[j] != '\0' && i + j < len && to_lower(txt[i + j]) == to_lower(pattern[j])) {
             j++;
         }
 
@@ -44,11 +78,11 @@ int substrings_match_caseless(const char* txt, const char* pattern) {
     return 0;
 }
 
-int substrings_match(const char* txt, const char* pattern) {
-    for (int i = 0; txt[i] != '\0'; i++) {
-        int j = 0;
+int substrings_match(const char* txt, size_t len, const char* pattern) {
+    for (size_t i = 0; i < len; i++) {
+        size_t j = 0;
 
-        while (pattern[j] != '\0' && txt[i + j] != '\0' && txt[i + j] == pattern[j]) {
+        while (pattern[j] != '\0' && i + j < len && txt[i + j] == pattern[j]) {
             j++;
         }
 
@@ -60,16 +94,35 @@ int substrings_match(const char* txt, const char* pattern) {
     return 0;
 }
 
-int match_line(const char* line, const char* pattern, int ignore_case) {
-    return ignore_case ? substrings_match_caseless(line, pattern) : substrings_match(line, pattern);
+int match_line(const char* line, size_t len, const char* pattern, int ignore_case) {
+    return ignore_case ? substrings_match_caseless(line, len, pattern) : substrings_match(line, len, pattern);
 }
 
 struct grep_flags parse_grep_flags(int argc, char* argv[]) {
-    struct grep_flags flags = {0, 0, 0, 0, 1};
+    struct grep_flags flags = {0, 0, 0, 0, BINARY_REPORT, -1, -1, 1};
 
     while (flags.pattern_idx < argc && argv[flags.pattern_idx][0] == '-') {
         const char* flag = argv[flags.pattern_idx] + 1;
 
+        if (flag[0] == '-') {
+            if (str_cmp(flag, "-binary-files=binary")) {
+                flags.binary = BINARY_REPORT;
+            }
+            else if (str_cmp(flag, "-binary-files=text")) {
+                flags.binary = BINARY_TEXT;
+            }
+            else if (str_cmp(flag, "-binary-files=without-match")) {
+                flags.binary = BINARY_SKIP;
+            }
+            else {
+                print_err("grep: unknown option -%s\n", flag);
+                print_err("enter 'grep -h' for information\n");
+                return flags;
+            }
+            flags.pattern_idx++;
+            continue;
+        }
+
         for (int i = 0; flag[i] != '\0'; i++) {
             if (flag[i] == 'i') {
                 flags.ignore_case = 1;
@@ -83,9 +136,28 @@ struct grep_flags parse_grep_flags(int argc, char* argv[]) {
             else if (flag[i] == 'r') {
                 flags.recurse = 1;
             }
+            else if (flag[i] == 'a') {
+                flags.binary = BINARY_TEXT;
+            }
+            else if (flag[i] == 'A' || flag[i] == 'B' || flag[i] == 'C') {
+                // the count is the rest of this word, or the next one
+                const char* count = flag[i + 1] != '\0' ? flag + i + 1 : argv[++flags.pattern_idx];
+                long lines;
+                if (flags.pattern_idx >= argc || parse_nonneg(count, &lines, NULL) != 0 ||
+                    lines > MAX_CONTEXT) {
+                    print_err("grep: invalid context length for -%c\n", flag[i]);
+                    flags.pattern_idx = argc;
+                    return flags;
+                }
+                if (flag[i] != 'B')
+                    flags.after = lines;
+                if (flag[i] != 'A')
+                    flags.before = lines;
+                break;
+            }
             else {
-                print("grep: unknown flag -%s\n", flag);
-                print("enter 'grep -h' for information\n");
+                print_err("grep: unknown flag -%s\n", flag);
+                print_err("enter 'grep -h' for information\n");
                 return flags;
             }
         }
@@ -101,7 +173,12 @@ void print_help() {
     print("Options:\n");
     print("-i: ignore case\n");
     print("-n: show line numbers on matched lines\n");
-    print("-r: search files recursively\n");
+    print("-r: search files recursively, skipping .git and anything matched by .gitignore/.ignore files\n");
+    print("-a: search binary files as if they were text\n");
+    print("-A <n>: also print n lines after each match\n");
+    print("-B <n>: also print n lines before each match\n");
+    print("-C <n>: also print n lines before and after each match\n");
+    print("--binary-files=<binary|text|without-match>: how to treat files that look binary\n");
 }
 
 void strip_quotes(char* pattern) {
@@ -118,154 +195,307 @@ void strip_quotes(char* pattern) {
     }
 }
 
-void print_match(const char* path, const char* line, const int line_number, const struct grep_flags* flags) {
+// sep is ':' for matching lines and '-' for context lines
+void print_match(const char* path, const char* line, size_t len, long line_number, char sep,
+                 const struct grep_flags* flags) {
     if (flags->recurse) {
-        print("%s%s%s: ", START_RED, path, END_COLOR);
+        print("%s%s%s%c ", START_RED, path, END_COLOR, sep);
     }
     if (flags->print_lines) {
-        print("%s%d%s: ", START_CYAN, line_number, END_COLOR);
+        print("%s%ld%s%c ", START_CYAN, line_number, END_COLOR, sep);
     }
-    print("%s", line);
-    print("\n");
+    print("%.*s\n", (int)len, line);
 }
 
-void process_file(const int fd, const char* path, const char* pattern, struct grep_flags* flags) {
-    char buf[BUF_SIZE];
-    char line[MAX_LINE_LEN];
-    int line_len    = 0;
-    int line_number = 1;
-
-    ssize_t n;
-    while ((n = read(fd, buf, BUF_SIZE)) > 0) {
-        for (ssize_t i = 0; i < n; i++) {
-            char c = buf[i];
-            if (c == '\n') {
-                line[line_len] = '\0';
-
-                int is_match = match_line(line, pattern, flags->ignore_case);
-                if (is_match)
-                    print_match(path, line, line_number, flags);
-
-                line_number++;
-                line_len = 0;
-            }
-            else {
-                if (line_len < (int)sizeof(line) - 1) {
-                    line[line_len] = c;
-                    line_len++;
-                }
-            }
+// length of the utf-8 sequence starting at p, 0 if it's malformed, -1 if it runs past end
+int utf8_seq_len(const unsigned char* p, const unsigned char* end) {
+    int len;
+    if (p[0] < 0x80)
+        return 1;
+    else if (p[0] >= 0xc2 && p[0] <= 0xdf)
+        len = 2;
+    else if (p[0] >= 0xe0 && p[0] <= 0xef)
+        len = 3;
+    else if (p[0] >= 0xf0 && p[0] <= 0xf4)
+        len = 4;
+    else
+        return 0;
+
+    for (int i = 1; i < len; i++) {
+        if (p + i >= end)
+            return -1;
+        if ((p[i] & 0xc0) != 0x80)
+            return 0;
+    }
+    return len;
+}
+
+// a file is binary if its first block has a nul byte or isn't valid utf-8
+int looks_binary(const char* data, size_t len) {
+    if (len > BINARY_PROBE_LEN)
+        len = BINARY_PROBE_LEN;
+
+    if (memchr(data, '\0', len))
+        return 1;
+
+    const unsigned char* p   = (const unsigned char*)data;
+    const unsigned char* end = p + len;
+    while (p < end) {
+        int seq = utf8_seq_len(p, end);
+        if (seq == 0)
+            return 1;
+        if (seq < 0) // cut off by the end of the probe, not an error
+            break;
+        p += seq;
+    }
+    return 0;
+}
+
+// prints the leading context held in the ring and then the match, "--" between groups that don't touch
+static void scan_match(struct grep_scan* sc, const char* base, size_t off, size_t len) {
+    const struct grep_flags* flags = sc->flags;
+
+    long first = sc->count > 0 ? sc->ring[sc->head].number : sc->line_number;
+    if ((flags->before >= 0 || flags->after >= 0) && sc->last_printed > 0 && first > sc->last_printed + 1)
+        print("--\n");
+
+    for (long i = 0; i < sc->count; i++) {
+        const struct line_span* ctx = &sc->ring[(sc->head + i) % flags->before];
+        print_match(sc->path, base + ctx->off, ctx->len, ctx->number, '-', flags);
+    }
+    sc->head  = 0;
+    sc->count = 0;
+
+    print_match(sc->path, base + off, len, sc->line_number, ':', flags);
+    sc->last_printed = sc->line_number;
+    sc->after_left   = flags->after;
+}
+
+static void scan_line(struct grep_scan* sc, const char* base, size_t off, size_t len) {
+    const struct grep_flags* flags = sc->flags;
+
+    if (match_line(base + off, len, sc->pattern, flags->ignore_case)) {
+        if (sc->is_binary) {
+            print("Binary file %s matches\n", sc->path);
+            sc->done = 1;
+            return;
         }
+        scan_match(sc, base, off, len);
+    }
+    else if (sc->after_left > 0) {
+        print_match(sc->path, base + off, len, sc->line_number, '-', flags);
+        sc->after_left--;
+        sc->last_printed = sc->line_number;
+    }
+    else if (flags->before > 0) {
+        // once the ring is full the newest line takes the oldest one's slot
+        long slot     = (sc->head + sc->count) % flags->before;
+        sc->ring[slot] = (struct line_span){off, len, sc->line_number};
+        if (sc->count < flags->before)
+            sc->count++;
+        else
+            sc->head = (sc->head + 1) % flags->before;
     }
 
-    if (line_len > 0) {
-        line[line_len] = '\0';
+    sc->line_number++;
+}
 
-        int is_match   = match_line(line, pattern, flags->ignore_case);
-        if (is_match)
-            print_match(path, line, line_number, flags);
+// runs every complete line in base[pos, len), returns where the unfinished last line starts
+static size_t scan_lines(struct grep_scan* sc, const char* base, size_t pos, size_t len) {
+    const char* nl;
+    while (!sc->done && (nl = memchr(base + pos, '\n', len - pos)) != NULL) {
+        size_t end = nl - base;
+        scan_line(sc, base, pos, end - pos);
+        pos = end + 1;
     }
+    return pos;
+}
+
+static void scan_check_binary(struct grep_scan* sc, const char* data, size_t len) {
+    sc->is_binary = sc->flags->binary != BINARY_TEXT && looks_binary(data, len);
+    if (sc->is_binary && sc->flags->binary == BINARY_SKIP)
+        sc->done = 1;
+}
+
+// the whole file is already addressable, so context spans point straight into the mapping
+static void scan_mapped(struct grep_scan* sc, const struct input* in) {
+    scan_check_binary(sc, in->map, in->size);
+
+    size_t pos = scan_lines(sc, in->map, 0, in->size);
+    if (!sc->done && pos < in->size)
+        scan_line(sc, in->map, pos, in->size - pos);
 }
 
-char* concat_path(const char* base, const char* file) {
-    const size_t base_len = str_len(base);
-    const size_t file_len = str_len(file);
+/*
+ * streamed input is read into a window that only ever holds the live part of the file:
+ * the buffered context lines and the unfinished line. before a refill that part is slid
+ * to the front, or the window doubles if it has grown past half of it, so every byte is
+ * moved a bounded number of times no matter how large -B is
+ */
+static void scan_stream(struct grep_scan* sc, struct input* in) {
+    size_t cap = 2 * INPUT_BUF_SIZE;
+    size_t len = 0;
+    size_t pos = 0;
+    char* win  = malloc(cap);
+    if (!win) {
+        print_err("grep: out of memory reading %s\n", sc->path);
+        return;
+    }
 
-    int slash_needed = (base[base_len - 1] != '/');
+    while (!sc->done) {
+        if (cap - len < INPUT_BUF_SIZE) {
+            size_t keep = sc->count > 0 ? sc->ring[sc->head].off : pos;
 
-    const size_t total_len = base_len + slash_needed + file_len + 1;
+            if (len - keep > cap / 2) {
+                char* grown = realloc(win, cap * 2);
+                if (!grown) {
+                    print_err("grep: out of memory reading %s\n", sc->path);
+                    break;
+                }
+                win = grown;
+                cap *= 2;
+            }
+            else if (keep > 0) {
+                memmove(win, win + keep, len - keep);
+                for (long i = 0; i < sc->count; i++)
+                    sc->ring[(sc->head + i) % sc->flags->before].off -= keep;
+                len -= keep;
+                pos -= keep;
+            }
+        }
 
-    char* out = (char*)malloc(total_len);
+        ssize_t n = input_read(in, win + len, cap - len);
+        if (n <= 0)
+            break;
 
-    char* p = out;
-    memcpy(p, base, base_len);
-    p += base_len;
+        if (sc->is_binary == -1) {
+            scan_check_binary(sc, win + len, n);
+            if (sc->done)
+                break;
+        }
 
-    if (slash_needed) {
-        *p = '/';
-        p++;
+        len += n;
+        pos = scan_lines(sc, win, pos, len);
     }
 
-    memcpy(p, file, file_len);
-    p += file_len;
+    if (!sc->done && pos < len)
+        scan_line(sc, win, pos, len - pos);
 
-    *p = '\0';
+    free(win);
+}
 
-    return out;
+void process_file(struct input* in, const char* path, const char* pattern, struct grep_flags* flags) {
+    struct grep_scan sc = {path, pattern, flags, NULL, 0, 0, 0, 0, 1, -1, 0};
+
+    if (flags->before > 0) {
+        sc.ring = malloc(flags->before * sizeof(struct line_span));
+        if (!sc.ring) {
+            print_err("grep: out of memory\n");
+            return;
+        }
+    }
+
+    if (in->map)
+        scan_mapped(&sc, in);
+    else
+        scan_stream(&sc, in);
+
+    free(sc.ring);
 }
 
-int grep_recursive(const char* path, const char* pattern, struct grep_flags* flags) {
+int grep_recursive(struct path_buf* path, const char* pattern, struct grep_flags* flags,
+                   const struct ignore_list* ignored) {
     struct stat statbuf;
 
-    if (stat(path, &statbuf) == -1) {
-        print("grep: path %s does not exist or error occured", path);
+    if (stat(path->data, &statbuf) == -1) {
+        print_err("grep: path %s does not exist or error occured", path->data);
         return -1;
     }
     else if (S_ISDIR(statbuf.st_mode)) {
 
-        const int path_fd = open(path, O_RDONLY | O_DIRECTORY);
+        const int path_fd = open(path->data, O_RDONLY | O_DIRECTORY);
         if (path_fd < 0) {
-            print("ls: could not open path '%s'\n", path);
+            print_err("ls: could not open path '%s'\n", path->data);
             return 0;
         }
 
+        // this directory's ignore files apply to everything below it
+        ignored = ignore_load(path, ignored);
+
         const size_t buf_size = 4096;
         char buf[buf_size];
-        const int n_read = get_dirents(path_fd, buf, buf_size);
+        int n_read;
 
-        if (n_read == -1) {
-            print("ls: SYS_getdents failed\n");
-            return 0;
-        }
+        // a directory can take more than one getdents call to list
+        while ((n_read = get_dirents(path_fd, buf, buf_size)) > 0) {
+            int idx = 0;
+            while (idx < n_read) {
+                struct linux_dirent* d = (struct linux_dirent*)(buf + idx);
 
-        int idx = 0;
-        while (idx < n_read) {
-            struct linux_dirent* d = (struct linux_dirent*)(buf + idx);
+                if (d->d_reclen == 0)
+                    break;
 
-            if (d->d_reclen == 0)
-                break;
+                if (str_cmp(d->d_name, ".") != 0 || str_cmp(d->d_name, "..") != 0 ||
+                    str_cmp(d->d_name, ".git") != 0) {
+                    idx += d->d_reclen;
+                    continue;
+                }
+
+                const size_t saved_len = path_push(path, d->d_name);
+                if (saved_len == PATH_PUSH_FAILED) {
+                    print_err("grep: out of memory building path under %s\n", path->data);
+                    break;
+                }
+
+                // getdents keeps the entry type in the record's last byte
+                char d_type = buf[idx + d->d_reclen - 1];
+                int is_dir  = d_type == DT_DIR;
+                if (d_type == DT_UNKNOWN) {
+                    struct stat entry_stat;
+                    is_dir = stat(path->data, &entry_stat) == 0 && S_ISDIR(entry_stat.st_mode);
+                }
+
+                if (!ignore_match(ignored, path, is_dir))
+                    grep_recursive(path, pattern, flags, ignored);
+                path_pop(path, saved_len);
 
-            if (str_cmp(d->d_name, ".") != 0 || str_cmp(d->d_name, "..") != 0) {
                 idx += d->d_reclen;
-                continue;
             }
+        }
 
-            const char* new_path = concat_path(path, d->d_name);
-            grep_recursive(new_path, pattern, flags);
-            free((void*)new_path);
+        if (n_read == -1)
+            print_err("ls: SYS_getdents failed\n");
 
-            idx += d->d_reclen;
-        }
         close(path_fd);
 
         return 0;
     }
     else if (S_ISREG(statbuf.st_mode)) {
-        int fd = open(path, O_RDONLY);
-        if (fd < 0) {
-            print("grep: error opening file %s\n", path);
+        struct input in;
+        if (input_open(&in, path->data) != 0) {
+            print_err("grep: error opening file %s\n", path->data);
             return 0;
         }
-        process_file(fd, path, pattern, flags);
+        process_file(&in, path->data, pattern, flags);
 
-        close(fd);
+        input_close(&in);
         return 0;
     }
     else {
-        print("grep: path %s is not a file or directory\n", path);
+        print_err("grep: path %s is not a file or directory\n", path->data);
         return 0;
     }
 }
 
 int builtin_grep(int argc, char* argv[]) {
     if (argc == 1) {
-        print("usage: grep <pattern> <file>\n");
-        print("enter 'grep -h' for information\n");
+        print_err("usage: grep <pattern> <file>\n");
+        print_err("enter 'grep -h' for information\n");
         return 0;
     }
     if (argc == 2) {
-        print("usage: grep <pattern> <file>\n");
-        print("enter 'grep -h' for information\n");
+        print_err("usage: grep <pattern> <file>\n");
+        print_err("enter 'grep -h' for information\n");
         return 0;
     }
 
@@ -277,8 +507,8 @@ int builtin_grep(int argc, char* argv[]) {
     }
 
     if (flags.pattern_idx + 2 > argc) {
-        print("usage: grep <pattern> <file>\n");
-        print("enter 'grep -h' for information\n");
+        print_err("usage: grep <pattern> <file>\n");
+        print_err("enter 'grep -h' for information\n");
         return 0;
     }
 
@@ -287,17 +517,27 @@ int builtin_grep(int argc, char* argv[]) {
     const char* file = argv[flags.pattern_idx + 1];
 
     if (flags.recurse) {
-        return grep_recursive(file, pattern, &flags);
+        struct path_buf path;
+        if (path_init(&path, file) != 0) {
+            print_err("grep: out of memory\n");
+            return 0;
+        }
+
+        int ret = grep_recursive(&path, pattern, &flags, NULL);
+        path_free(&path);
+
+        // -1 is reserved for "not a builtin"
+        return ret == -1 ? 1 : 0;
     }
 
-    int fd = open(file, O_RDONLY);
-    if (fd < 0) {
-        print("grep: error opening file %s\n", file);
+    struct input in;
+    if (input_open(&in, file) != 0) {
+        print_err("grep: error opening file %s\n", file);
         return 0;
     }
 
-    process_file(fd, file, pattern, &flags);
+    process_file(&in, file, pattern, &flags);
 
-    close(fd);
+    input_close(&in);
     return 0;
 }
@@ -0,0 +1,379 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/arena.h"
+#include "include/command.h"
+#include "include/input.h"
+#include "include/path.h"
+#include "include/print.h"
+#include "include/scan.h"
+#include "include/tokenize.h"
+
+#define DEFAULT_LINES 10
+#define TAIL_BLOCK_SIZE (256 * 1024)
+
+struct head_tail_flags {
+    long lines;
+    int follow;
+    int file_idx;
+};
+
+static struct head_tail_flags parse_head_tail_flags(const char* name, int argc, char* argv[], int allow_follow) {
+    struct head_tail_flags flags = {DEFAULT_LINES, 0, 1};
+
+    while (flags.file_idx < argc && argv[flags.file_idx][0] == '-') {
+        const char* flag = argv[flags.file_idx];
+
+        if (flag[1] == 'n') {
+            const char* count = flag[2] != '\0' ? flag + 2 : argv[++flags.file_idx];
+            if (count == NULL || parse_nonneg(count, &flags.lines, NULL) != 0) {
+                print_err("%s: invalid line count\n", name);
+                flags.file_idx = -1;
+                return flags;
+            }
+        }
+        else if (allow_follow && str_cmp(flag, "-f")) {
+            flags.follow = 1;
+        }
+        else {
+            print_err("%s: unknown flag %s\n", name, flag);
+            flags.file_idx = -1;
+            return flags;
+        }
+        flags.file_idx++;
+    }
+
+    return flags;
+}
+
+static void print_header(const char* path, int first) {
+    print("%s==> %s <==\n", first ? "" : "\n", path);
+}
+
+static void head_file(const char* path, long n_lines) {
+    struct input in;
+    if (input_open(&in, path) != 0) {
+        print_err("head: cannot open file: %s\n", path);
+        return;
+    }
+
+    // stop at the nth newline, a mapped file never gets faulted in past it
+    const char* data;
+    ssize_t n;
+    while (n_lines > 0 && (n = input_next(&in, &data)) > 0) {
+        const char* p   = data;
+        const char* end = data + n;
+        while (n_lines > 0 && (p = memchr(p, '\n', end - p)) != NULL) {
+            p++;
+            n_lines--;
+        }
+
+        print_bytes(data, (n_lines == 0 ? p : end) - data);
+    }
+
+    input_close(&in);
+}
+
+int builtin_head(int argc, char* argv[]) {
+    struct head_tail_flags flags = parse_head_tail_flags("head", argc, argv, 0);
+    if (flags.file_idx < 0 || flags.file_idx >= argc) {
+        print_err("usage: head [-n <lines>] <file> ...\n");
+        return 0;
+    }
+
+    int many = argc - flags.file_idx > 1;
+    for (int i = flags.file_idx; i < argc; i++) {
+        if (many)
+            print_header(argv[i], i == flags.file_idx);
+        head_file(argv[i], flags.lines);
+    }
+
+    return 0;
+}
+
+/*
+ * offset where the last n_lines lines of the file begin, found by reading backwards
+ * in large blocks; the newline that terminates the final line doesn't count
+ */
+static off_t find_tail_start(int fd, off_t size, long n_lines) {
+    if (n_lines == 0 || size == 0)
+        return size;
+
+    char* block = arena_alloc(cmd_arena(), TAIL_BLOCK_SIZE);
+    if (!block)
+        return -1;
+
+    long seen = 0;
+    off_t end = size;
+
+    while (end > 0) {
+        off_t start = end > TAIL_BLOCK_SIZE ? end - TAIL_BLOCK_SIZE : 0;
+        if (pread_all(fd, block, end - start, start) != 0)
+            return -1;
+
+        ssize_t idx = end - start;
+        while ((idx = scan_rfind_newline(block, idx)) >= 0) {
+            if (start + idx == size - 1)
+                continue;
+            if (++seen == n_lines)
+                return start + idx + 1;
+        }
+
+        end = start;
+    }
+
+    return 0;
+}
+
+// copies [from, size) to the output with a single write out of a mapping of that range
+static int print_range(int fd, off_t from, off_t size) {
+    if (from >= size)
+        return 0;
+
+    const off_t page  = sysconf(_SC_PAGESIZE);
+    const off_t start = from & ~(page - 1);
+
+    char* map = mmap(NULL, size - start, PROT_READ, MAP_PRIVATE, fd, start);
+    if (map == MAP_FAILED)
+        return -1;
+
+    print_bytes(map + (from - start), size - from);
+    munmap(map, size - start);
+    return 0;
+}
+
+// everything appended since pos goes out as it's read; returns the new position
+static off_t print_appended(const char* path, int fd, off_t pos) {
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return pos;
+
+    if (st.st_size < pos) {
+        print_err("tail: %s: file truncated\n", path);
+        pos = 0;
+    }
+
+    char buf[INPUT_BUF_SIZE];
+    while (pos < st.st_size) {
+        ssize_t n = pread(fd, buf, sizeof(buf), pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        print_bytes(buf, n);
+        pos += n;
+    }
+
+    return pos;
+}
+
+static void dir_of(struct path_buf* dir, const char* path) {
+    const char* slash = NULL;
+    for (const char* p = path; *p; p++) {
+        if (*p == '/')
+            slash = p;
+    }
+
+    if (!slash) {
+        path_init(dir, ".");
+    }
+    else if (slash == path) {
+        path_init(dir, "/");
+    }
+    else if (path_init(dir, path) == 0) {
+        path_pop(dir, slash - path);
+    }
+}
+
+/*
+ * sleeps on inotify instead of polling. the parent directory is watched too, so when
+ * the log is rotated (the path now names a different inode) the new file is picked up.
+ * on a terminal, pressing enter stops following
+ */
+static void follow_file(const char* path, int fd, off_t pos) {
+    int ino_fd = inotify_init1(IN_CLOEXEC);
+    if (ino_fd < 0) {
+        print_err("tail: inotify unavailable, cannot follow %s\n", path);
+        return;
+    }
+
+    const uint32_t file_events = IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF;
+    int file_wd                = inotify_add_watch(ino_fd, path, file_events);
+
+    struct path_buf dir;
+    dir_of(&dir, path);
+    if (dir.data)
+        inotify_add_watch(ino_fd, dir.data, IN_CREATE | IN_MOVED_TO);
+    path_free(&dir);
+
+    struct stat st;
+    fstat(fd, &st);
+    dev_t cur_dev = st.st_dev;
+    ino_t cur_ino = st.st_ino;
+
+    struct pollfd fds[2] = {
+        {ino_fd, POLLIN, 0},
+        {STDIN_FILENO, POLLIN, 0},
+    };
+    nfds_t n_fds = isatty(STDIN_FILENO) ? 2 : 1;
+
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    while (1) {
+        if (poll(fds, n_fds, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        if (n_fds == 2 && fds[1].revents) {
+            char discard[256];
+            read(STDIN_FILENO, discard, sizeof(discard));
+            break;
+        }
+
+        // which events arrived doesn't matter, the file and the path are both rechecked
+        if (read(ino_fd, events, sizeof(events)) < 0 && errno != EAGAIN && errno != EINTR)
+            break;
+
+        pos = print_appended(path, fd, pos);
+
+        if (stat(path, &st) != 0 || (st.st_dev == cur_dev && st.st_ino == cur_ino))
+            continue;
+
+        int new_fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (new_fd < 0)
+            continue;
+
+        print_err("tail: %s has been replaced, following new file\n", path);
+        close(fd);
+        fd      = new_fd;
+        pos     = 0;
+        cur_dev = st.st_dev;
+        cur_ino = st.st_ino;
+
+        if (file_wd >= 0)
+            inotify_rm_watch(ino_fd, file_wd);
+        file_wd = inotify_add_watch(ino_fd, path, file_events);
+
+        pos = print_appended(path, fd, pos);
+    }
+
+    close(fd);
+    close(ino_fd);
+}
+
+// pipes and other unseekable input are read whole, then searched the same way
+static void tail_stream(struct input* in, long n_lines) {
+    size_t cap  = INPUT_BUF_SIZE;
+    size_t len  = 0;
+    char* whole = malloc(cap);
+
+    const char* data;
+    ssize_t n;
+    while (whole && (n = input_next(in, &data)) > 0) {
+        if (len + n > cap) {
+            while (len + n > cap)
+                cap *= 2;
+            char* grown = realloc(whole, cap);
+            if (!grown) {
+                free(whole);
+                whole = NULL;
+                break;
+            }
+            whole = grown;
+        }
+        memcpy(whole + len, data, n);
+        len += n;
+    }
+
+    if (!whole) {
+        print_err("tail: out of memory\n");
+        return;
+    }
+
+    size_t start = len;
+    if (n_lines > 0) {
+        long seen   = 0;
+        ssize_t idx = len;
+        start       = 0;
+        while ((idx = scan_rfind_newline(whole, idx)) >= 0) {
+            if ((size_t)idx == len - 1)
+                continue;
+            if (++seen == n_lines) {
+                start = idx + 1;
+                break;
+            }
+        }
+    }
+
+    print_bytes(whole + start, len - start);
+    free(whole);
+}
+
+static void tail_file(const char* path, const struct head_tail_flags* flags) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        print_err("tail: cannot open file: %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return;
+    }
+
+    if (!S_ISREG(st.st_mode)) {
+        close(fd);
+
+        struct input in;
+        if (input_open(&in, path) != 0) {
+            print_err("tail: cannot open file: %s\n", path);
+            return;
+        }
+        tail_stream(&in, flags->lines);
+        input_close(&in);
+        return;
+    }
+
+    off_t start = find_tail_start(fd, st.st_size, flags->lines);
+    if (start < 0 || print_range(fd, start, st.st_size) != 0) {
+        print_err("tail: error reading file: %s\n", path);
+        close(fd);
+        return;
+    }
+
+    if (flags->follow) {
+        follow_file(path, fd, st.st_size); // takes ownership of the fd
+        return;
+    }
+
+    close(fd);
+}
+
+int builtin_tail(int argc, char* argv[]) {
+    struct head_tail_flags flags = parse_head_tail_flags("tail", argc, argv, 1);
+    if (flags.file_idx < 0 || flags.file_idx >= argc) {
+        print_err("usage: tail [-n <lines>] [-f] <file> ...\n");
+        return 0;
+    }
+
+    int many = argc - flags.file_idx > 1;
+    if (many && flags.follow) {
+        print_err("tail: -f follows a single file\n");
+        return 0;
+    }
+
+    for (int i = flags.file_idx; i < argc; i++) {
+        if (many)
+            print_header(argv[i], i == flags.file_idx);
+        tail_file(argv[i], &flags);
+    }
+
+    return 0;
+}
@@ -0,0 +1,259 @@
+#include <fnmatch.h>
+#include <limits.h>
+#include <string.h>
+
+#include "include/arena.h"
+#include "include/ignore.h"
+#include "include/input.h"
+#include "include/print.h"
+#include "include/tokenize.h"
+
+#define MAX_RULES 512 // per directory, across all of its ignore files
+
+static const char* ignore_files[] = {".gitignore", ".ignore", NULL};
+
+static int has_wildcard(const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '*' || s[i] == '?' || s[i] == '[' || s[i] == '\\')
+            return 1;
+    }
+    return 0;
+}
+
+// turns one line of an ignore file into a rule; returns 0 for blank lines and comments
+static int compile_rule(const char* line, size_t len, struct ignore_rule* rule) {
+    while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == ' '))
+        len--;
+    if (len == 0 || line[0] == '#')
+        return 0;
+
+    rule->negate    = 0;
+    rule->dir_only  = 0;
+    rule->anchored  = 0;
+    rule->any_depth = 0;
+
+    if (line[0] == '!') {
+        rule->negate = 1;
+        line++;
+        len--;
+    }
+    else if (line[0] == '\\' && len > 1 && (line[1] == '#' || line[1] == '!')) {
+        line++;
+        len--;
+    }
+
+    if (len > 0 && line[len - 1] == '/') {
+        rule->dir_only = 1;
+        len--;
+    }
+    /*
+     * a leading "**" matches at any depth. for a single component that is what an
+     * unanchored pattern does anyway, "**" followed by more components is tried
+     * against every tail of the relative path instead
+     */
+    if (len > 3 && line[0] == '*' && line[1] == '*' && line[2] == '/') {
+        line += 3;
+        len -= 3;
+        rule->any_depth = 1;
+    }
+    else if (len > 0 && line[0] == '/') {
+        rule->anchored = 1;
+        line++;
+        len--;
+    }
+    if (memchr(line, '/', len))
+        rule->anchored = 1;
+    else
+        rule->any_depth = 0;
+    if (len == 0)
+        return 0;
+
+    char* pattern = arena_alloc(cmd_arena(), len + 1);
+    if (!pattern)
+        return 0;
+    memcpy(pattern, line, len);
+    pattern[len] = '\0';
+
+    rule->pattern = pattern;
+    rule->len     = len;
+
+    if (!has_wildcard(pattern, len))
+        rule->kind = IGNORE_LITERAL;
+    else if (pattern[0] == '*' && !has_wildcard(pattern + 1, len - 1) && !rule->anchored)
+        rule->kind = IGNORE_SUFFIX;
+    else
+        rule->kind = IGNORE_GLOB;
+
+    return 1;
+}
+
+static void load_file(struct path_buf* dir, const char* name, struct ignore_rule* rules, int* n_rules) {
+    const size_t saved = path_push(dir, name);
+    if (saved == PATH_PUSH_FAILED)
+        return;
+
+    struct input in;
+    if (input_open(&in, dir->data) != 0) {
+        path_pop(dir, saved);
+        return;
+    }
+    path_pop(dir, saved);
+
+    // lines may straddle stream chunks, so collect into a line buffer
+    char line[1024];
+    size_t line_len = 0;
+
+    const char* data;
+    ssize_t n;
+    while ((n = input_next(&in, &data)) > 0) {
+        for (ssize_t i = 0; i < n; i++) {
+            if (data[i] != '\n') {
+                if (line_len < sizeof(line))
+                    line[line_len++] = data[i];
+                continue;
+            }
+            if (*n_rules < MAX_RULES && compile_rule(line, line_len, &rules[*n_rules]))
+                (*n_rules)++;
+            line_len = 0;
+        }
+    }
+    if (line_len > 0 && *n_rules < MAX_RULES && compile_rule(line, line_len, &rules[*n_rules]))
+        (*n_rules)++;
+
+    input_close(&in);
+}
+
+// returns parent unchanged when the directory has no ignore files of its own
+const struct ignore_list* ignore_load(struct path_buf* dir, const struct ignore_list* parent) {
+    struct ignore_rule rules[MAX_RULES];
+    int n_rules = 0;
+
+    for (int i = 0; ignore_files[i] != NULL; i++)
+        load_file(dir, ignore_files[i], rules, &n_rules);
+
+    if (n_rules == 0)
+        return parent;
+
+    struct ignore_list* list = arena_alloc(cmd_arena(), sizeof(*list));
+    struct ignore_rule* kept = arena_alloc(cmd_arena(), n_rules * sizeof(*kept));
+    if (!list || !kept)
+        return parent;
+
+    memcpy(kept, rules, n_rules * sizeof(*kept));
+    list->parent   = parent;
+    list->base_len = dir->len;
+    list->rules    = kept;
+    list->n_rules  = n_rules;
+    return list;
+}
+
+// finds the next "/**" that makes up a whole component, "a/**/b" or a trailing "a/**"
+static const char* find_globstar(const char* pattern) {
+    for (const char* p = strstr(pattern, "/**"); p != NULL; p = strstr(p + 1, "/**")) {
+        if (p[3] == '/' || p[3] == '\0')
+            return p;
+    }
+    return NULL;
+}
+
+// fnmatch with FNM_PATHNAME, plus gitignore's "**" components: a trailing one matches
+// everything below what comes before it, one in the middle any number of directories
+static int match_path(const char* pattern, const char* path) {
+    const char* star = find_globstar(pattern);
+    if (star == NULL)
+        return fnmatch(pattern, path, FNM_PATHNAME) == 0;
+
+    char head[PATH_MAX];
+    char prefix[PATH_MAX];
+    const size_t head_len = star - pattern;
+    if (head_len >= sizeof(head))
+        return 0;
+    memcpy(head, pattern, head_len);
+    head[head_len] = '\0';
+
+    const char* tail = star[3] == '/' ? star + 4 : NULL;
+    while (tail != NULL && tail[0] == '*' && tail[1] == '*' && tail[2] == '/')
+        tail += 3; // repeated "**" components add nothing
+
+    // the head has to match whole leading components, cut at each '/' in turn
+    for (const char* slash = strchr(path, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+        const size_t prefix_len = slash - path;
+        if (prefix_len >= sizeof(prefix))
+            return 0;
+        memcpy(prefix, path, prefix_len);
+        prefix[prefix_len] = '\0';
+        if (fnmatch(head, prefix, FNM_PATHNAME) != 0)
+            continue;
+
+        if (tail == NULL)
+            return slash[1] != '\0';
+
+        // the "**" takes any number of the components that follow
+        for (const char* rest = slash + 1; rest != NULL; rest = strchr(rest, '/')) {
+            if (*rest == '/')
+                rest++;
+            if (match_path(tail, rest))
+                return 1;
+        }
+    }
+    return 0;
+}
+
+static int match_anchored(const struct ignore_rule* rule, const char* subject) {
+    if (rule->kind == IGNORE_LITERAL)
+        return str_cmp(subject, rule->pattern);
+    return match_path(rule->pattern, subject);
+}
+
+static int rule_matches(const struct ignore_rule* rule, const char* rel, const char* name, size_t name_len) {
+    if (rule->any_depth) {
+        // every tail of rel that starts at a component
+        for (const char* sub = rel; sub != NULL; sub = strchr(sub, '/')) {
+            if (*sub == '/')
+                sub++;
+            if (match_anchored(rule, sub))
+                return 1;
+        }
+        return 0;
+    }
+    if (rule->anchored)
+        return match_anchored(rule, rel);
+
+    switch (rule->kind) {
+        case IGNORE_LITERAL:
+            return name_len == rule->len && memcmp(name, rule->pattern, name_len) == 0;
+        case IGNORE_SUFFIX:
+            return name_len >= rule->len - 1 &&
+                   memcmp(name + name_len - (rule->len - 1), rule->pattern + 1, rule->len - 1) == 0;
+        case IGNORE_GLOB:
+            return fnmatch(rule->pattern, name, 0) == 0;
+    }
+    return 0;
+}
+
+/*
+ * the deepest ignore file wins, and within a file the last matching rule wins, so
+ * rules are tried from the bottom of the innermost list outwards
+ */
+int ignore_match(const struct ignore_list* list, const struct path_buf* path, int is_dir) {
+    const char* name = path->data + path->len;
+    while (name > path->data && name[-1] != '/')
+        name--;
+    const size_t name_len = path->data + path->len - name;
+
+    for (; list != NULL; list = list->parent) {
+        const char* rel = path->data + list->base_len;
+        while (*rel == '/')
+            rel++;
+
+        for (int i = list->n_rules - 1; i >= 0; i--) {
+            const struct ignore_rule* rule = &list->rules[i];
+            if (rule->dir_only && !is_dir)
+                continue;
+            if (rule_matches(rule, rel, name, name_len))
+                return !rule->negate;
+        }
+    }
+
+    return 0;
+}
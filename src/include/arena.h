@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN      16
+
+struct arena_block {
+    struct arena_block* next;
+    size_t cap;
+    size_t used;
+    char data[];
+};
+
+/*
+ * bump allocator: allocations are never freed individually, arena_reset() drops
+ * everything at once but keeps the blocks around for the next command
+ */
+struct arena {
+    struct arena_block* head;
+    struct arena_block* cur;
+    size_t used;       // bytes handed out since the last reset
+    size_t high_water; // largest `used` ever seen
+    size_t capacity;   // bytes held in blocks
+    size_t n_blocks;
+};
+
+struct arena_stats {
+    size_t used;
+    size_t high_water;
+    size_t capacity;
+    size_t n_blocks;
+};
+
+void* arena_alloc(struct arena* a, size_t size);
+char* arena_strdup(struct arena* a, const char* s);
+void arena_reset(struct arena* a);
+void arena_release(struct arena* a);
+struct arena_stats arena_get_stats(const struct arena* a);
+
+// scratch arena for the builtin currently running on this thread, reset by run_builtin
+struct arena* cmd_arena(void);
+
+#endif
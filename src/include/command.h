@@ -6,7 +6,7 @@
 #include <fcntl.h>
 #include <sys/syscall.h>
 
-void run_external(int argc, char* argv[]);
+int run_external(int argc, char* argv[]);
 int run_builtin(int argc, char* argv[]);
 
 int builtin_ls(int argc, char* argv[]);
@@ -19,6 +19,13 @@ int builtin_pwd(int argc, char* argv[]);
 int builtin_mkdir(int argc, char* argv[]);
 int builtin_touch(int argc, char* argv[]);
 int builtin_cat(int argc, char* argv[]);
+int builtin_wc(int argc, char* argv[]);
+int builtin_head(int argc, char* argv[]);
+int builtin_tail(int argc, char* argv[]);
+int builtin_sort(int argc, char* argv[]);
+
+int create_file(const char* file_path);
+int file_exists(const char* file_path);
 
 int get_dirents(const int path_fd, const char buf[], const int buf_size);
 
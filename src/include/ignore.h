@@ -0,0 +1,38 @@
+#ifndef IGNORE_H
+#define IGNORE_H
+
+#include <stddef.h>
+
+#include "path.h"
+
+enum ignore_kind {
+    IGNORE_LITERAL, // no wildcards, plain string compare
+    IGNORE_SUFFIX,  // "*.ext", compares the tail of the name
+    IGNORE_GLOB,    // anything else, goes through fnmatch
+};
+
+struct ignore_rule {
+    const char* pattern;
+    size_t len;
+    enum ignore_kind kind;
+    int negate;    // "!pattern" re-includes
+    int dir_only;  // "pattern/" only matches directories
+    int anchored;  // contains a '/', matched against the path relative to the ignore file
+    int any_depth; // anchored, but began with "**/" so it may start at any component of that path
+};
+
+/*
+ * the rules from one directory's .gitignore/.ignore, chained to the rules of the
+ * directories above it. everything lives in the command arena
+ */
+struct ignore_list {
+    const struct ignore_list* parent;
+    size_t base_len; // length of the directory's path, entries below it start after this
+    struct ignore_rule* rules;
+    int n_rules;
+};
+
+const struct ignore_list* ignore_load(struct path_buf* dir, const struct ignore_list* parent);
+int ignore_match(const struct ignore_list* list, const struct path_buf* path, int is_dir);
+
+#endif
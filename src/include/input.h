@@ -0,0 +1,28 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define INPUT_BUF_SIZE (64 * 1024)
+
+/*
+ * a file opened for reading front to back. regular files are mmapped and handed out
+ * as a single chunk, anything else (pipes, ttys, empty/special files) is streamed
+ * through a read buffer taken from the command arena
+ */
+struct input {
+    int fd;
+    char* map;   // whole file when mmapped, NULL when streaming
+    size_t size; // file size when mmapped
+    int done;
+    char* buf;
+};
+
+int input_open(struct input* in, const char* path);
+ssize_t input_next(struct input* in, const char** data);
+ssize_t input_read(struct input* in, char* dst, size_t cap);
+int pread_all(int fd, char* buf, size_t len, off_t off);
+void input_close(struct input* in);
+
+#endif
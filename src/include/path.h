@@ -0,0 +1,24 @@
+#ifndef PATH_H
+#define PATH_H
+
+#include <stddef.h>
+
+/*
+ * one growing buffer holding the path of the entry currently being visited:
+ * descending pushes a component, coming back up pops to the saved length
+ */
+struct path_buf {
+    char* data;
+    size_t len;
+    size_t cap;
+};
+
+int path_init(struct path_buf* p, const char* base);
+size_t path_push(struct path_buf* p, const char* name);
+size_t path_append(struct path_buf* p, const char* text);
+void path_pop(struct path_buf* p, size_t len);
+void path_free(struct path_buf* p);
+
+#define PATH_PUSH_FAILED ((size_t)-1)
+
+#endif
@@ -14,10 +14,23 @@
 
 #define END_COLOR "\033[0m"
 
+#define PRINT_BUF_SIZE 4096
+
+/*
+ * print() understands %[-0][width][.precision][l|z] followed by d, i, u, x, f, c or s
+ * ("%.*s" prints a span that isn't nul terminated). the format attribute lets the
+ * compiler check every call site's arguments against its format string
+ */
 size_t str_len(const char* s);
 void print_int(long n);
 void print_float(double n, int dp);
 void print_char(char c);
-void print(const char* fmt, ...);
+void print_bytes(const char* s, size_t len);
+void print(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void print_err(const char* fmt, ...) __attribute__((format(printf, 1, 2))); // diagnostics, to stderr
+
+void print_set_output(int out, int err);
+int print_out_fd(void);
+int print_err_fd(void);
 
 #endif
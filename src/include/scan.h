@@ -0,0 +1,26 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/*
+ * byte scanning kernels shared by the text builtins. whitespace means the C locale
+ * isspace() set: ' ', \t, \n, \v, \f and \r
+ */
+static inline int scan_is_space(unsigned char c) {
+    return c == ' ' || (unsigned char)(c - '\t') <= '\r' - '\t';
+}
+
+size_t scan_count_newlines(const char* p, size_t n);
+
+/*
+ * counts words starting in p[0..n). *in_space says whether the byte before p was
+ * whitespace (1 at the start of a file) and is updated to the state after p[n - 1]
+ */
+size_t scan_count_words(const char* p, size_t n, int* in_space);
+
+// index of the last '\n' in p[0..n), or -1 if there is none
+ssize_t scan_rfind_newline(const char* p, size_t n);
+
+#endif
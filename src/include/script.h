@@ -0,0 +1,38 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <stdint.h>
+
+#define SCRIPT_CACHE_MAGIC   "SHCACHE1"
+#define SCRIPT_CACHE_VERSION 1
+#define SCRIPT_RACY_SECS     2
+
+/*
+ * layout of a compiled script, everything addressed by offsets so the file can be
+ * mmapped anywhere and run in place:
+ *   header
+ *   source path (nul terminated, padded to 8 bytes)
+ *   u32 argc for every command             at cmds_off
+ *   u32 string offset for every token      at tokens_off
+ *   nul terminated token strings           at strings_off
+ */
+struct script_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_cmds;
+    uint32_t n_tokens;
+    uint32_t path_len;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t cmds_off;
+    uint64_t tokens_off;
+    uint64_t strings_off;
+    uint64_t file_len;
+};
+
+int script_run(const char* path);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+/*
+ * wire format (host byte order, it's a local socket):
+ *   request:  u32 length, then <length> bytes of newline separated commands
+ *   response: per command an 'O' (stdout), 'E' (stderr: builtin print_err() diagnostics
+ *             and external commands' stderr) and 'X' (exit status) frame,
+ *             then a single 'D' frame once the whole batch is done. output of 4GiB or
+ *             more doesn't fit one frame and is sent as consecutive frames of the same
+ *             type, to be concatenated by the reader
+ *   frame:    u8 type, u32 length, then <length> bytes of payload
+ */
+
+#define FRAME_STDOUT 'O'
+#define FRAME_STDERR 'E'
+#define FRAME_EXIT   'X'
+#define FRAME_DONE   'D'
+
+#define SERVER_WORKERS   4
+#define SERVER_MAX_BATCH (16 * 1024 * 1024)
+#define SERVER_IO_TIMEOUT 5 // seconds a worker waits on a stalled client before dropping it
+
+int server_run(const char* sock_path);
+int client_run(const char* sock_path);
+
+#endif
@@ -7,6 +7,12 @@
 
 int str_cmp(const char* s1, const char* s2);
 
+/*
+ * parses a non-negative decimal number. with rest == NULL all of s must be the number,
+ * otherwise *rest is left pointing just past it. returns 0 on success, -1 otherwise
+ */
+int parse_nonneg(const char* s, long* out, const char** rest);
+
 int tokenize(char* input, char* argv[]);
 
 #endif
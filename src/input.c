@@ -0,0 +1,98 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "include/arena.h"
+#include "include/input.h"
+
+// returns 0 on success, -1 with errno set if the file can't be opened
+int input_open(struct input* in, const char* path) {
+    in->map  = NULL;
+    in->size = 0;
+    in->done = 0;
+    in->buf  = NULL;
+
+    in->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (in->fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat(in->fd, &st) != 0) {
+        close(in->fd);
+        return -1;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        close(in->fd);
+        errno = EISDIR;
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            in->map  = map;
+            in->size = st.st_size;
+        }
+    }
+
+    return 0;
+}
+
+// points *data at the next chunk of the file; returns its length, 0 at eof, -1 on error
+ssize_t input_next(struct input* in, const char** data) {
+    if (in->map) {
+        if (in->done)
+            return 0;
+        in->done = 1;
+        *data    = in->map;
+        return in->size;
+    }
+
+    if (!in->buf) {
+        in->buf = arena_alloc(cmd_arena(), INPUT_BUF_SIZE);
+        if (!in->buf)
+            return -1;
+    }
+
+    ssize_t n;
+    do {
+        n = read(in->fd, in->buf, INPUT_BUF_SIZE);
+    } while (n < 0 && errno == EINTR);
+
+    *data = in->buf;
+    return n;
+}
+
+// streaming only: reads straight into the caller's buffer, for callers that keep their own window
+ssize_t input_read(struct input* in, char* dst, size_t cap) {
+    ssize_t n;
+    do {
+        n = read(in->fd, dst, cap);
+    } while (n < 0 && errno == EINTR);
+
+    return n;
+}
+
+// reads exactly len bytes at off; -1 on error or if the file ends first
+int pread_all(int fd, char* buf, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+        off += n;
+    }
+    return 0;
+}
+
+void input_close(struct input* in) {
+    if (in->map)
+        munmap(in->map, in->size);
+    close(in->fd);
+}
@@ -16,7 +16,7 @@ int builtin_ls(int argc, char* argv[]) {
 
     const int path_fd = open(path, O_RDONLY | O_DIRECTORY);
     if (path_fd < 0) {
-        print("ls: could not open path '%s'\n", path);
+        print_err("ls: could not open path '%s'\n", path);
         return 0;
     }
 
@@ -26,15 +26,14 @@ int builtin_ls(int argc, char* argv[]) {
     const int n_read = get_dirents(path_fd, buf, buf_size);
 
     if (n_read == -1) {
-        print("ls: SYS_getdents failed\n");
+        print_err("ls: SYS_getdents failed\n");
         return 0;
     }
 
     int idx = 0;
     while (idx < n_read) {
         struct linux_dirent* d = (struct linux_dirent*)(buf + idx);
-        print(d->d_name);
-        print("\n");
+        print("%s\n", d->d_name);
 
         idx += d->d_reclen;
     }
@@ -3,27 +3,36 @@
 #include "include/print.h"
 #include "include/tokenize.h"
 #include "include/command.h"
+#include "include/script.h"
+#include "include/server.h"
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && str_cmp(argv[1], "--serve"))
+        return server_run(argv[2]);
+    if (argc == 3 && str_cmp(argv[1], "--client"))
+        return client_run(argv[2]);
+    if (argc == 2)
+        return script_run(argv[1]);
 
-int main() {
     char buf[256];
-    char* argv[MAX_TOKENS];
+    char* tokens[MAX_TOKENS];
 
     while (1) {
         print(" ❯ ");
 
-        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        ssize_t n = read(STDIN_FILENO, buf, sizeof(buf) - 1);
         if (n <= 0)
             break;
 
         buf[n] = '\0';
-        int argc = tokenize(buf, argv);
+        int n_tokens = tokenize(buf, tokens);
 
-        if (argc == 0)
+        if (n_tokens == 0)
             continue;
 
-        if (run_builtin(argc, argv) == -1) {
+        if (run_builtin(n_tokens, tokens) == -1) {
+            run_external(n_tokens, tokens);
         }
 
     }
 }
-
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "include/path.h"
+#include "include/print.h"
+
+static int path_reserve(struct path_buf* p, size_t needed) {
+    if (needed <= p->cap)
+        return 0;
+
+    size_t cap = p->cap ? p->cap : 256;
+    while (cap < needed)
+        cap *= 2;
+
+    char* grown = realloc(p->data, cap);
+    if (!grown)
+        return -1;
+
+    p->data = grown;
+    p->cap  = cap;
+    return 0;
+}
+
+int path_init(struct path_buf* p, const char* base) {
+    p->data = NULL;
+    p->len  = 0;
+    p->cap  = 0;
+
+    size_t len = str_len(base);
+    if (path_reserve(p, len + 1) != 0)
+        return -1;
+
+    memcpy(p->data, base, len + 1);
+    p->len = len;
+    return 0;
+}
+
+// appends text as-is (no separator), returns the length to pop back to or PATH_PUSH_FAILED
+size_t path_append(struct path_buf* p, const char* text) {
+    const size_t saved    = p->len;
+    const size_t text_len = str_len(text);
+
+    if (path_reserve(p, p->len + text_len + 1) != 0)
+        return PATH_PUSH_FAILED;
+
+    memcpy(p->data + p->len, text, text_len + 1);
+    p->len += text_len;
+
+    return saved;
+}
+
+// appends "/name", returns the length to pop back to or PATH_PUSH_FAILED
+size_t path_push(struct path_buf* p, const char* name) {
+    const size_t saved    = p->len;
+    const size_t name_len = str_len(name);
+    int slash_needed      = (p->len > 0 && p->data[p->len - 1] != '/');
+
+    if (path_reserve(p, p->len + slash_needed + name_len + 1) != 0)
+        return PATH_PUSH_FAILED;
+
+    if (slash_needed)
+        p->data[p->len++] = '/';
+    memcpy(p->data + p->len, name, name_len + 1);
+    p->len += name_len;
+
+    return saved;
+}
+
+void path_pop(struct path_buf* p, size_t len) {
+    p->len       = len;
+    p->data[len] = '\0';
+}
+
+void path_free(struct path_buf* p) {
+    free(p->data);
+    p->data = NULL;
+    p->len  = 0;
+    p->cap  = 0;
+}
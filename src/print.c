@@ -1,9 +1,74 @@
-#include <limits.h>
+#include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "include/print.h"
 
+// per-thread so server workers can each capture their own request's output
+static __thread int out_fd = STDOUT_FILENO;
+static __thread int err_fd = STDERR_FILENO;
+
+void print_set_output(int out, int err) {
+    out_fd = out;
+    err_fd = err;
+}
+
+int print_out_fd(void) {
+    return out_fd;
+}
+
+int print_err_fd(void) {
+    return err_fd;
+}
+
+// every print() call is formatted into one of these and flushed with as few writes as possible
+struct out_buf {
+    char data[PRINT_BUF_SIZE];
+    size_t len;
+    int fd;
+};
+
+static void write_all(int fd, const char* s, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, s, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        s += n;
+        len -= n;
+    }
+}
+
+static void ob_flush(struct out_buf* ob) {
+    write_all(ob->fd, ob->data, ob->len);
+    ob->len = 0;
+}
+
+static void ob_put(struct out_buf* ob, const char* s, size_t len) {
+    if (len > sizeof(ob->data) - ob->len) {
+        ob_flush(ob);
+        if (len > sizeof(ob->data)) { // too big to be worth copying
+            write_all(ob->fd, s, len);
+            return;
+        }
+    }
+    for (size_t i = 0; i < len; i++)
+        ob->data[ob->len + i] = s[i];
+    ob->len += len;
+}
+
+static void ob_fill(struct out_buf* ob, char c, int count) {
+    while (count-- > 0) {
+        if (ob->len == sizeof(ob->data))
+            ob_flush(ob);
+        ob->data[ob->len++] = c;
+    }
+}
+
 size_t str_len(const char* s) {
     if (s == NULL)
         return 0;
@@ -15,104 +80,392 @@ size_t str_len(const char* s) {
     return len;
 }
 
-void print_int(long n) {
-    if (n == 0) {
-        write(STDOUT_FILENO, "0", 1);
-        return;
+// like str_len, but never looks further than max bytes (for "%.*s" on unterminated spans)
+static size_t str_len_max(const char* s, size_t max) {
+    size_t len = 0;
+    while (len < max && s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_digits[] = "0123456789abcdef";
+
+// writes n right-aligned so it ends at `end`, two digits per division; returns the first char
+static char* fmt_uint(char* end, unsigned long long n) {
+    char* p = end;
+    while (n >= 100) {
+        unsigned idx = (n % 100) * 2;
+        n /= 100;
+        *--p = digit_pairs[idx + 1];
+        *--p = digit_pairs[idx];
+    }
+    if (n >= 10) {
+        *--p = digit_pairs[n * 2 + 1];
+        *--p = digit_pairs[n * 2];
+    }
+    else {
+        *--p = '0' + n;
     }
+    return p;
+}
+
+static char* fmt_hex(char* end, unsigned long long n) {
+    char* p = end;
+    do {
+        *--p = hex_digits[n & 0xf];
+        n >>= 4;
+    } while (n != 0);
+    return p;
+}
+
+/*
+ * a parsed conversion spec: %[-0][width][.precision][l|z]conv
+ * width/precision are -1 when absent
+ */
+struct fmt_spec {
+    int left;
+    int zero;
+    int width;
+    int precision;
+    char length;
+    char conv;
+};
 
-    if (n == LONG_MIN) { // because -LONG_MIN is undefined
-        print("-9223372036854775808");
+static void put_padded(struct out_buf* ob, const struct fmt_spec* spec, const char* sign, const char* body,
+                       size_t body_len) {
+    size_t sign_len = str_len(sign);
+    int pad         = spec->width - (int)(sign_len + body_len);
+
+    if (pad > 0 && !spec->left && !spec->zero)
+        ob_fill(ob, ' ', pad);
+    ob_put(ob, sign, sign_len);
+    if (pad > 0 && !spec->left && spec->zero)
+        ob_fill(ob, '0', pad);
+    ob_put(ob, body, body_len);
+    if (pad > 0 && spec->left)
+        ob_fill(ob, ' ', pad);
+}
+
+static void put_signed(struct out_buf* ob, const struct fmt_spec* spec, long long n) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+
+    // negate in unsigned space so LLONG_MIN doesn't overflow
+    unsigned long long mag = n < 0 ? 0ULL - (unsigned long long)n : (unsigned long long)n;
+    char* start            = fmt_uint(end, mag);
+    put_padded(ob, spec, n < 0 ? "-" : "", start, end - start);
+}
+
+static void put_unsigned(struct out_buf* ob, const struct fmt_spec* spec, unsigned long long n) {
+    char buf[24];
+    char* end   = buf + sizeof(buf);
+    char* start = spec->conv == 'x' ? fmt_hex(end, n) : fmt_uint(end, n);
+    put_padded(ob, spec, "", start, end - start);
+}
+
+static const unsigned long long pow10_table[] = {
+    1ULL,
+    10ULL,
+    100ULL,
+    1000ULL,
+    10000ULL,
+    100000ULL,
+    1000000ULL,
+    10000000ULL,
+    100000000ULL,
+    1000000000ULL,
+    10000000000ULL,
+    100000000000ULL,
+    1000000000000ULL,
+    10000000000000ULL,
+    100000000000000ULL,
+    1000000000000000ULL,
+    10000000000000000ULL,
+};
+
+#define MAX_FLOAT_DP 16
+
+#define BIG_LIMBS    36 // base 1e9 limbs, enough for DBL_MAX's 309 digits
+#define BIG_LIMB_MOD 1000000000U
+
+/*
+ * n is at least 2^64, so it's a whole number: its 53-bit mantissa shifted left by the
+ * exponent. the shifting is done on a base 1e9 big integer so every digit comes out exact
+ */
+static void put_large_float(struct out_buf* ob, const struct fmt_spec* spec, const char* sign, double n, int dp) {
+    unsigned long long bits;
+    memcpy(&bits, &n, sizeof(bits));
+
+    int biased = (bits >> 52) & 0x7ff;
+    if (biased == 0x7ff) {
+        put_padded(ob, spec, sign, "inf", 3);
         return;
     }
-    if (n < 0) {
-        write(STDOUT_FILENO, "-", 1);
-        n = -n;
+
+    unsigned long long mantissa = (bits & ((1ULL << 52) - 1)) | (1ULL << 52);
+    int shift                   = biased - 1075;
+
+    uint32_t limbs[BIG_LIMBS];
+    int n_limbs = 0;
+    while (mantissa > 0) {
+        limbs[n_limbs++] = mantissa % BIG_LIMB_MOD;
+        mantissa /= BIG_LIMB_MOD;
     }
 
-    char buf[32];
-    int idx = 0;
-    while (n > 0) {
-        buf[idx++] = '0' + (n % 10);
-        n /= 10;
+    while (shift > 0) {
+        int step                 = shift > 29 ? 29 : shift; // limb << 29 still fits 64 bits with the carry
+        unsigned long long carry = 0;
+        for (int i = 0; i < n_limbs; i++) {
+            unsigned long long v = ((unsigned long long)limbs[i] << step) + carry;
+            limbs[i]             = v % BIG_LIMB_MOD;
+            carry                = v / BIG_LIMB_MOD;
+        }
+        while (carry > 0) {
+            limbs[n_limbs++] = carry % BIG_LIMB_MOD;
+            carry /= BIG_LIMB_MOD;
+        }
+        shift -= step;
+    }
+
+    char buf[BIG_LIMBS * 9 + MAX_FLOAT_DP + 2];
+    char* p = buf;
+
+    char digits[12];
+    char* end   = digits + sizeof(digits);
+    char* start = fmt_uint(end, limbs[n_limbs - 1]);
+    memcpy(p, start, end - start);
+    p += end - start;
+
+    // every lower limb is exactly nine digits, leading zeros included
+    for (int i = n_limbs - 2; i >= 0; i--) {
+        start = fmt_uint(end, limbs[i]);
+        while (start > end - 9)
+            *--start = '0';
+        memcpy(p, start, 9);
+        p += 9;
     }
 
-    while (idx > 0) {
-        idx--;
-        write(STDOUT_FILENO, &buf[idx], 1);
+    if (dp > 0) {
+        *p++ = '.';
+        memset(p, '0', dp);
+        p += dp;
     }
+
+    put_padded(ob, spec, sign, buf, p - buf);
 }
 
-void print_float(double n, int dp) {
-    if (dp < 0)
-        dp = 6;
+static void put_float(struct out_buf* ob, const struct fmt_spec* spec, double n) {
+    int dp = spec->precision < 0 ? 6 : spec->precision;
+    if (dp > MAX_FLOAT_DP)
+        dp = MAX_FLOAT_DP;
 
+    const char* sign = "";
     if (n < 0) {
-        write(STDOUT_FILENO, "-", 1);
-        n = -n;
+        sign = "-";
+        n    = -n;
     }
 
-    long whole     = (long)n;
-    double decimal = n - (double)whole;
+    if (n != n) {
+        put_padded(ob, spec, "", "nan", 3);
+        return;
+    }
+    if (n >= 1.8e19) { // doesn't fit the integer path
+        put_large_float(ob, spec, sign, n, dp);
+        return;
+    }
 
-    print_int(whole);
-    if (dp > 0)
-        write(STDOUT_FILENO, ".", 1);
+    // scale the fraction once and round, instead of peeling digits off with repeated *10
+    unsigned long long whole = (unsigned long long)n;
+    unsigned long long scale = pow10_table[dp];
+    unsigned long long frac  = (unsigned long long)((n - (double)whole) * (double)scale + 0.5);
+    if (frac >= scale) {
+        whole++;
+        frac -= scale;
+    }
 
-    // 6 dp
-    for (int i = 0; i < dp; i++) {
-        decimal *= 10;
-        int digit = (int)decimal;
-        char c    = '0' + digit;
-        write(STDOUT_FILENO, &c, 1);
-        decimal -= digit;
+    char buf[48];
+    char* end = buf + sizeof(buf);
+    char* p   = end;
+    if (dp > 0) {
+        char* frac_start = fmt_uint(end, frac);
+        p                = end - dp;
+        while (frac_start > p)
+            *--frac_start = '0';
+        *--p = '.';
     }
+    p = fmt_uint(p, whole);
+
+    put_padded(ob, spec, sign, p, end - p);
 }
 
-void print_char(char c) {
-    write(STDOUT_FILENO, &c, 1);
+// which chars can appear where in a spec; anything unlisted ends the spec as its conversion
+enum { CH_OTHER, CH_FLAG, CH_DIGIT, CH_DOT, CH_STAR, CH_LENGTH };
+
+static const unsigned char spec_class[256] = {
+    ['-'] = CH_FLAG,  ['0'] = CH_FLAG,  ['1'] = CH_DIGIT, ['2'] = CH_DIGIT,  ['3'] = CH_DIGIT,
+    ['4'] = CH_DIGIT, ['5'] = CH_DIGIT, ['6'] = CH_DIGIT, ['7'] = CH_DIGIT,  ['8'] = CH_DIGIT,
+    ['9'] = CH_DIGIT, ['.'] = CH_DOT,   ['*'] = CH_STAR,  ['l'] = CH_LENGTH, ['z'] = CH_LENGTH,
+};
+
+// parses the spec after '%', returns a pointer to the conversion char (or the terminating '\0')
+static const char* parse_spec(const char* p, struct fmt_spec* spec, va_list* args) {
+    spec->left      = 0;
+    spec->zero      = 0;
+    spec->width     = -1;
+    spec->precision = -1;
+    spec->length    = 0;
+
+    for (; spec_class[(unsigned char)*p] == CH_FLAG; p++) {
+        if (*p == '-')
+            spec->left = 1;
+        else
+            spec->zero = 1;
+    }
+
+    if (*p == '*') {
+        spec->width = va_arg(*args, int);
+        if (spec->width < 0) {
+            spec->left  = 1;
+            spec->width = -spec->width;
+        }
+        p++;
+    }
+    else if (spec_class[(unsigned char)*p] == CH_DIGIT) {
+        spec->width = 0;
+        for (; *p >= '0' && *p <= '9'; p++)
+            spec->width = spec->width * 10 + (*p - '0');
+    }
+
+    if (*p == '.') {
+        p++;
+        spec->precision = 0;
+        if (*p == '*') {
+            spec->precision = va_arg(*args, int);
+            p++;
+        }
+        else {
+            for (; *p >= '0' && *p <= '9'; p++)
+                spec->precision = spec->precision * 10 + (*p - '0');
+        }
+    }
+
+    for (; spec_class[(unsigned char)*p] == CH_LENGTH; p++)
+        spec->length = *p;
+
+    spec->conv = *p;
+    return p;
 }
 
-void print(const char* fmt, ...) {
-    va_list args;
-    va_start(args, fmt);
+static void vprint(int fd, const char* fmt, va_list* args) {
+    struct out_buf ob;
+    ob.len = 0;
+    ob.fd  = fd;
 
-    for (int i = 0; fmt[i] != '\0'; i++) {
-        if (fmt[i] == '%') {
+    const char* p = fmt;
+    while (*p != '\0') {
+        // copy the literal run up to the next '%' in one go
+        const char* run = p;
+        while (*p != '\0' && *p != '%')
+            p++;
+        ob_put(&ob, run, p - run);
 
-            i++;
-            char spec = fmt[i];
+        if (*p == '\0')
+            break;
 
-            if (spec == '\0') {
-                print_char('%');
-                return;
-            }
+        struct fmt_spec spec;
+        p = parse_spec(p + 1, &spec, args);
 
-            if (spec == 'd') {
-                long n = va_arg(args, long);
-                print_int(n);
-            }
-            else if (spec == 'f') {
-                double f = va_arg(args, double);
-                print_float(f, -1);
-            }
-            else if (spec == 'c') {
-                char c = (char)va_arg(args, int);
-                print_char(c);
-            }
-            else if (spec == 's') {
-                char* s = va_arg(args, char*);
-                write(STDOUT_FILENO, s, str_len(s));
-            }
-            else if (spec == '%') {
-                print_char('%');
+        switch (spec.conv) {
+            case '\0':
+                ob_put(&ob, "%", 1);
+                ob_flush(&ob);
+                return;
+            case 'd':
+            case 'i':
+                if (spec.length == 'l')
+                    put_signed(&ob, &spec, va_arg(*args, long));
+                else if (spec.length == 'z')
+                    put_signed(&ob, &spec, va_arg(*args, ssize_t));
+                else
+                    put_signed(&ob, &spec, va_arg(*args, int));
+                break;
+            case 'u':
+            case 'x':
+                if (spec.length == 'l')
+                    put_unsigned(&ob, &spec, va_arg(*args, unsigned long));
+                else if (spec.length == 'z')
+                    put_unsigned(&ob, &spec, va_arg(*args, size_t));
+                else
+                    put_unsigned(&ob, &spec, va_arg(*args, unsigned int));
+                break;
+            case 'f':
+                put_float(&ob, &spec, va_arg(*args, double));
+                break;
+            case 'c': {
+                char c = (char)va_arg(*args, int);
+                put_padded(&ob, &spec, "", &c, 1);
+                break;
             }
-            else {
-                print_char(spec);
+            case 's': {
+                const char* s = va_arg(*args, const char*);
+                if (s == NULL)
+                    s = "(null)";
+                size_t len = spec.precision < 0 ? str_len(s) : str_len_max(s, spec.precision);
+                put_padded(&ob, &spec, "", s, len);
+                break;
             }
+            case '%':
+                ob_put(&ob, "%", 1);
+                break;
+            default:
+                ob_put(&ob, &spec.conv, 1);
+                break;
         }
-        else {
-            write(STDOUT_FILENO, &fmt[i], 1);
-        }
+        p++;
     }
+
+    ob_flush(&ob);
+}
+
+void print_int(long n) {
+    print("%ld", n);
+}
+
+void print_float(double n, int dp) {
+    print("%.*f", dp < 0 ? 6 : dp, n);
+}
+
+void print_char(char c) {
+    write_all(out_fd, &c, 1);
+}
+
+void print_bytes(const char* s, size_t len) {
+    write_all(out_fd, s, len);
+}
+
+void print(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprint(out_fd, fmt, &args);
+    va_end(args);
+}
+
+void print_err(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vprint(err_fd, fmt, &args);
+    va_end(args);
 }
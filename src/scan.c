@@ -0,0 +1,97 @@
+#include "include/scan.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+size_t scan_count_newlines(const char* p, size_t n) {
+    size_t count = 0;
+    size_t i     = 0;
+
+#ifdef __SSE2__
+    const __m128i nl   = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+
+    while (n - i >= 16) {
+        // per-byte counters can take 255 hits before they have to be summed
+        __m128i acc  = zero;
+        size_t limit = (n - i) / 16;
+        if (limit > 255)
+            limit = 255;
+
+        for (size_t k = 0; k < limit; k++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+            acc       = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+        }
+
+        __m128i sums = _mm_sad_epu8(acc, zero);
+        count += (size_t)_mm_cvtsi128_si32(sums) + (size_t)_mm_extract_epi16(sums, 4);
+    }
+#endif
+
+    for (; i < n; i++)
+        count += (p[i] == '\n');
+
+    return count;
+}
+
+size_t scan_count_words(const char* p, size_t n, int* in_space) {
+    size_t count  = 0;
+    size_t i      = 0;
+    unsigned prev = *in_space ? 1 : 0;
+
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab   = _mm_set1_epi8('\t');
+    const __m128i four  = _mm_set1_epi8('\r' - '\t');
+
+    for (; n - i >= 16; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+
+        // \t..\r is a contiguous range: c - '\t' <= 4 unsigned, done as min(x, 4) == x
+        __m128i off   = _mm_sub_epi8(v, tab);
+        __m128i ctrl  = _mm_cmpeq_epi8(_mm_min_epu8(off, four), off);
+        __m128i ws    = _mm_or_si128(ctrl, _mm_cmpeq_epi8(v, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(ws);
+
+        // a word starts at every non-space byte whose predecessor is a space
+        unsigned starts = ~mask & ((mask << 1) | prev) & 0xffff;
+        count += __builtin_popcount(starts);
+        prev = mask >> 15;
+    }
+#endif
+
+    for (; i < n; i++) {
+        unsigned ws = scan_is_space(p[i]);
+        count += (ws == 0) & prev;
+        prev = ws;
+    }
+
+    *in_space = prev;
+    return count;
+}
+
+ssize_t scan_rfind_newline(const char* p, size_t n) {
+    size_t i = n;
+
+#ifdef __SSE2__
+    const __m128i nl = _mm_set1_epi8('\n');
+
+    // walk 16 byte blocks from the end, the highest set bit is the last newline in a block
+    while (i >= 16) {
+        i -= 16;
+        __m128i v     = _mm_loadu_si128((const __m128i*)(p + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask)
+            return i + 31 - __builtin_clz(mask);
+    }
+#endif
+
+    while (i > 0) {
+        i--;
+        if (p[i] == '\n')
+            return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,411 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "include/command.h"
+#include "include/path.h"
+#include "include/print.h"
+#include "include/script.h"
+#include "include/tokenize.h"
+
+#define ALIGN8(n) (((n) + 7) & ~(uint64_t)7)
+
+// growable arrays used while compiling, before the final size of the image is known
+struct parsed_script {
+    uint32_t* argcs;
+    size_t n_cmds;
+    size_t cmds_cap;
+    char** tokens;
+    size_t n_tokens;
+    size_t tokens_cap;
+    size_t strings_len;
+};
+
+static int grow(void** arr, size_t* cap, size_t elem_size, size_t needed) {
+    if (needed <= *cap)
+        return 0;
+
+    size_t new_cap = *cap ? *cap * 2 : 256;
+    while (new_cap < needed)
+        new_cap *= 2;
+
+    void* grown = realloc(*arr, new_cap * elem_size);
+    if (!grown)
+        return -1;
+
+    *arr = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static uint64_t hash_path(const char* s) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// $XDG_CACHE_HOME/shell/<hash of path>.cache, creating the directories on the way
+static int cache_path(struct path_buf* out, const char* real_path) {
+    const char* xdg  = getenv("XDG_CACHE_HOME");
+    const char* home = getenv("HOME");
+
+    if (xdg && xdg[0] != '\0') {
+        if (path_init(out, xdg) != 0)
+            return -1;
+        mkdir(out->data, 0700);
+    }
+    else if (home && home[0] != '\0') {
+        if (path_init(out, home) != 0)
+            return -1;
+        if (path_push(out, ".cache") == PATH_PUSH_FAILED) {
+            path_free(out);
+            return -1;
+        }
+        mkdir(out->data, 0700);
+    }
+    else {
+        return -1;
+    }
+
+    if (path_push(out, "shell") == PATH_PUSH_FAILED) {
+        path_free(out);
+        return -1;
+    }
+    if (mkdir(out->data, 0700) != 0 && errno != EEXIST) {
+        path_free(out);
+        return -1;
+    }
+
+    char name[] = "0000000000000000.cache";
+    uint64_t h  = hash_path(real_path);
+    for (int i = 15; i >= 0; i--) {
+        name[i] = "0123456789abcdef"[h & 0xf];
+        h >>= 4;
+    }
+
+    if (path_push(out, name) == PATH_PUSH_FAILED) {
+        path_free(out);
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_script(char* src, size_t src_len, struct parsed_script* ps) {
+    char* argv[MAX_TOKENS];
+    char* line = src;
+
+    while (line < src + src_len) {
+        char* end = memchr(line, '\n', src + src_len - line);
+        if (end)
+            *end = '\0';
+        else
+            end = src + src_len;
+
+        char* p = line;
+        while (*p == ' ' || *p == '\t')
+            p++;
+
+        int argc = (*p == '#') ? 0 : tokenize(p, argv);
+        line     = end + 1;
+
+        if (argc == 0)
+            continue;
+
+        if (grow((void**)&ps->argcs, &ps->cmds_cap, sizeof(*ps->argcs), ps->n_cmds + 1) != 0 ||
+            grow((void**)&ps->tokens, &ps->tokens_cap, sizeof(*ps->tokens), ps->n_tokens + argc) != 0)
+            return -1;
+
+        ps->argcs[ps->n_cmds++] = argc;
+        for (int i = 0; i < argc; i++) {
+            ps->tokens[ps->n_tokens++] = argv[i];
+            ps->strings_len += str_len(argv[i]) + 1;
+        }
+    }
+
+    return 0;
+}
+
+// flattens the parsed script into a position independent image, see script.h
+static char* build_image(const struct parsed_script* ps, const struct stat* st, const char* real_path,
+                         size_t* image_len) {
+    const size_t path_len = str_len(real_path);
+
+    const uint64_t cmds_off    = ALIGN8(sizeof(struct script_header) + path_len + 1);
+    const uint64_t tokens_off  = ALIGN8(cmds_off + ps->n_cmds * sizeof(uint32_t));
+    const uint64_t strings_off = ALIGN8(tokens_off + ps->n_tokens * sizeof(uint32_t));
+    const uint64_t file_len    = strings_off + ps->strings_len;
+
+    if (ps->strings_len > UINT32_MAX)
+        return NULL;
+
+    char* img = calloc(1, file_len);
+    if (!img)
+        return NULL;
+
+    struct script_header* hdr = (struct script_header*)img;
+    memcpy(hdr->magic, SCRIPT_CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version     = SCRIPT_CACHE_VERSION;
+    hdr->n_cmds      = ps->n_cmds;
+    hdr->n_tokens    = ps->n_tokens;
+    hdr->path_len    = path_len;
+    hdr->dev         = st->st_dev;
+    hdr->ino         = st->st_ino;
+    hdr->size        = st->st_size;
+    hdr->mtime_sec   = st->st_mtim.tv_sec;
+    hdr->mtime_nsec  = st->st_mtim.tv_nsec;
+    hdr->cmds_off    = cmds_off;
+    hdr->tokens_off  = tokens_off;
+    hdr->strings_off = strings_off;
+    hdr->file_len    = file_len;
+
+    memcpy(img + sizeof(*hdr), real_path, path_len + 1);
+    memcpy(img + cmds_off, ps->argcs, ps->n_cmds * sizeof(uint32_t));
+
+    uint32_t* offsets = (uint32_t*)(img + tokens_off);
+    uint32_t str_off  = 0;
+    for (size_t i = 0; i < ps->n_tokens; i++) {
+        size_t len = str_len(ps->tokens[i]) + 1;
+        memcpy(img + strings_off + str_off, ps->tokens[i], len);
+        offsets[i] = str_off;
+        str_off += len;
+    }
+
+    *image_len = file_len;
+    return img;
+}
+
+// an image is only trusted if it was compiled from this exact file, unchanged since
+static int image_valid(const char* img, size_t len, const struct stat* st, const char* real_path) {
+    if (len < sizeof(struct script_header))
+        return 0;
+
+    const struct script_header* hdr = (const struct script_header*)img;
+
+    if (memcmp(hdr->magic, SCRIPT_CACHE_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != SCRIPT_CACHE_VERSION)
+        return 0;
+    if (hdr->file_len != len || hdr->dev != (uint64_t)st->st_dev || hdr->ino != (uint64_t)st->st_ino ||
+        hdr->size != (uint64_t)st->st_size || hdr->mtime_sec != st->st_mtim.tv_sec ||
+        hdr->mtime_nsec != st->st_mtim.tv_nsec)
+        return 0;
+    if (hdr->path_len != str_len(real_path) || sizeof(*hdr) + hdr->path_len + 1 > len ||
+        memcmp(img + sizeof(*hdr), real_path, hdr->path_len + 1) != 0)
+        return 0;
+
+    // reject anything whose tables would point outside the file
+    if (hdr->cmds_off + (uint64_t)hdr->n_cmds * sizeof(uint32_t) > hdr->tokens_off ||
+        hdr->tokens_off + (uint64_t)hdr->n_tokens * sizeof(uint32_t) > hdr->strings_off || hdr->strings_off > len)
+        return 0;
+
+    // the last token string must be terminated inside the file, or argv could run off the mapping
+    if (hdr->n_tokens > 0 && (len <= hdr->strings_off || img[len - 1] != '\0'))
+        return 0;
+
+    return 1;
+}
+
+static int run_image(char* img) {
+    const struct script_header* hdr = (const struct script_header*)img;
+    const uint32_t* argcs           = (const uint32_t*)(img + hdr->cmds_off);
+    const uint32_t* offsets         = (const uint32_t*)(img + hdr->tokens_off);
+    char* strings                   = img + hdr->strings_off;
+    const uint64_t strings_len      = hdr->file_len - hdr->strings_off;
+
+    char* argv[MAX_TOKENS];
+    int status       = 0;
+    uint32_t tok_idx = 0;
+
+    for (uint32_t cmd = 0; cmd < hdr->n_cmds; cmd++) {
+        uint32_t argc = argcs[cmd];
+        if (argc == 0 || argc >= MAX_TOKENS || tok_idx + argc > hdr->n_tokens)
+            return 1;
+
+        for (uint32_t i = 0; i < argc; i++) {
+            uint32_t off = offsets[tok_idx++];
+            if (off >= strings_len)
+                return 1;
+            argv[i] = strings + off;
+        }
+        argv[argc] = NULL;
+
+        status = run_builtin(argc, argv);
+        if (status == -1)
+            status = run_external(argc, argv);
+    }
+
+    return status;
+}
+
+/*
+ * runs the cached image if there's a valid one; returns 1 with its exit status in *status,
+ * or 0 on a miss. the status can't double as the hit flag, a command may return -1 too
+ */
+static int map_cached(const char* cache_file, const struct stat* st, const char* real_path, int* status) {
+    int fd = open(cache_file, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+
+    struct stat cache_st;
+    if (fstat(fd, &cache_st) != 0 || cache_st.st_size < (off_t)sizeof(struct script_header)) {
+        close(fd);
+        return 0;
+    }
+
+    // private and writable: builtins may edit their argv in place, which must not reach the file
+    char* img = mmap(NULL, cache_st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (img == MAP_FAILED)
+        return 0;
+
+    if (!image_valid(img, cache_st.st_size, st, real_path)) {
+        munmap(img, cache_st.st_size);
+        return 0;
+    }
+
+    *status = run_image(img);
+    munmap(img, cache_st.st_size);
+    return 1;
+}
+
+// written to a temp file first so a concurrent run never maps a half written image
+static void write_cache(const struct path_buf* cache_file, const char* img, size_t len) {
+    struct path_buf tmp;
+    if (path_init(&tmp, cache_file->data) != 0)
+        return;
+    if (path_append(&tmp, ".XXXXXX") == PATH_PUSH_FAILED) {
+        path_free(&tmp);
+        return;
+    }
+
+    int fd = mkstemp(tmp.data);
+    if (fd < 0) {
+        path_free(&tmp);
+        return;
+    }
+
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, img + done, len - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    close(fd);
+
+    if (done != len || rename(tmp.data, cache_file->data) != 0)
+        unlink(tmp.data);
+
+    path_free(&tmp);
+}
+
+/*
+ * mtimes are only as fine grained as the kernel's clock tick, so a script rewritten
+ * twice within one tick to the same size keeps its identity. such a script isn't
+ * cached until it has been left alone for a while
+ */
+static int recently_modified(const struct stat* st) {
+    struct timespec now;
+    if (clock_gettime(CLOCK_REALTIME, &now) != 0)
+        return 1;
+    return now.tv_sec - st->st_mtim.tv_sec < SCRIPT_RACY_SECS;
+}
+
+static char* read_source(int fd, size_t size) {
+    char* src = malloc(size + 1);
+    if (!src)
+        return NULL;
+
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, src + done, size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (done != size) {
+        free(src);
+        return NULL;
+    }
+
+    src[size] = '\0';
+    return src;
+}
+
+int script_run(const char* path) {
+    char real_path[PATH_MAX];
+    if (!realpath(path, real_path)) {
+        print_err("shell: no such script: %s\n", path);
+        return 1;
+    }
+
+    int fd = open(real_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        print_err("shell: cannot read script: %s\n", path);
+        if (fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    struct path_buf cache_file;
+    int have_cache = cache_path(&cache_file, real_path) == 0;
+
+    if (have_cache) {
+        int status;
+        if (map_cached(cache_file.data, &st, real_path, &status)) {
+            close(fd);
+            path_free(&cache_file);
+            return status;
+        }
+    }
+
+    // missing or stale: compile from source, refresh the cache, run the fresh image
+    char* src = read_source(fd, st.st_size);
+    close(fd);
+    if (!src) {
+        print_err("shell: error reading script: %s\n", path);
+        if (have_cache)
+            path_free(&cache_file);
+        return 1;
+    }
+
+    struct parsed_script ps;
+    memset(&ps, 0, sizeof(ps));
+
+    char* img        = NULL;
+    size_t image_len = 0;
+    if (parse_script(src, st.st_size, &ps) == 0)
+        img = build_image(&ps, &st, real_path, &image_len);
+
+    free(ps.argcs);
+    free(ps.tokens);
+    free(src);
+
+    if (!img) {
+        print_err("shell: out of memory compiling script: %s\n", path);
+        if (have_cache)
+            path_free(&cache_file);
+        return 1;
+    }
+
+    if (have_cache) {
+        if (!recently_modified(&st))
+            write_cache(&cache_file, img, image_len);
+        path_free(&cache_file);
+    }
+
+    int status = run_image(img);
+    free(img);
+    return status;
+}
@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "include/command.h"
+#include "include/print.h"
+#include "include/server.h"
+#include "include/tokenize.h"
+
+#define QUEUE_SIZE 256
+#define IO_BUF_SIZE 65536
+
+struct job_queue {
+    int fds[QUEUE_SIZE];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+};
+
+struct server {
+    int listen_fd;
+    int epoll_fd;
+    struct job_queue queue;
+};
+
+static int write_all(int fd, const void* buf, size_t len) {
+    const char* p = buf;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// returns 1 on success, 0 on a clean eof before any bytes, -1 on error
+static int read_all(int fd, void* buf, size_t len) {
+    char* p     = buf;
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, p + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            return done == 0 ? 0 : -1;
+        done += n;
+    }
+    return 1;
+}
+
+static int send_frame_header(int fd, char type, uint32_t len) {
+    char hdr[5];
+    hdr[0] = type;
+    memcpy(hdr + 1, &len, sizeof(len));
+    return write_all(fd, hdr, sizeof(hdr));
+}
+
+static int send_frame(int fd, char type, const void* payload, uint32_t len) {
+    if (send_frame_header(fd, type, len) != 0)
+        return -1;
+    return write_all(fd, payload, len);
+}
+
+// empties a capture fd so the next command starts writing at offset 0
+static void reset_capture(int capture_fd) {
+    ftruncate(capture_fd, 0);
+    lseek(capture_fd, 0, SEEK_SET);
+}
+
+/*
+ * streams everything a command wrote into its capture fd back to the client. a frame
+ * length is only 32 bits, so output of 4GiB or more goes out as several frames
+ */
+static int send_capture(int client_fd, char type, int capture_fd) {
+    off_t size = lseek(capture_fd, 0, SEEK_END);
+    if (size < 0)
+        return -1;
+
+    char buf[IO_BUF_SIZE];
+    off_t off = 0;
+    do {
+        uint32_t frame_len = size - off > UINT32_MAX ? UINT32_MAX : (uint32_t)(size - off);
+        if (send_frame_header(client_fd, type, frame_len) != 0)
+            return -1;
+
+        off_t frame_end = off + frame_len;
+        while (off < frame_end) {
+            size_t want = sizeof(buf);
+            if (frame_end - off < (off_t)want)
+                want = frame_end - off;
+            ssize_t n = pread(capture_fd, buf, want, off);
+            if (n <= 0)
+                return -1;
+            if (write_all(client_fd, buf, n) != 0)
+                return -1;
+            off += n;
+        }
+    } while (off < size);
+
+    return 0;
+}
+
+static void queue_push(struct job_queue* q, int fd) {
+    pthread_mutex_lock(&q->lock);
+    if (q->count == QUEUE_SIZE) {
+        // every worker is busy and the backlog is full, shed the connection
+        pthread_mutex_unlock(&q->lock);
+        close(fd);
+        return;
+    }
+    q->fds[(q->head + q->count) % QUEUE_SIZE] = fd;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int queue_pop(struct job_queue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0)
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    int fd  = q->fds[q->head];
+    q->head = (q->head + 1) % QUEUE_SIZE;
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return fd;
+}
+
+// runs one batch; returns 0 to keep the connection open, -1 to close it
+static int handle_request(int client_fd, int out_fd, int err_fd) {
+    uint32_t len;
+    if (read_all(client_fd, &len, sizeof(len)) != 1)
+        return -1;
+    if (len > SERVER_MAX_BATCH)
+        return -1;
+
+    char* batch = malloc(len + 1);
+    if (!batch)
+        return -1;
+    if (len > 0 && read_all(client_fd, batch, len) != 1) {
+        free(batch);
+        return -1;
+    }
+    batch[len] = '\0';
+
+    int keep_open = 0;
+    char* argv[MAX_TOKENS];
+    char* line = batch;
+
+    while (line < batch + len) {
+        char* end = memchr(line, '\n', batch + len - line);
+        if (end)
+            *end = '\0';
+        else
+            end = batch + len;
+
+        int argc = tokenize(line, argv);
+        line     = end + 1;
+
+        if (argc == 0)
+            continue;
+
+        // exit ends this client's session, not the daemon
+        if (str_cmp(argv[0], "exit")) {
+            int32_t status = 0;
+            send_frame(client_fd, FRAME_EXIT, &status, sizeof(status));
+            keep_open = -1;
+            break;
+        }
+
+        /*
+         * the captures belong to the worker, not the client. output left behind by a
+         * command whose client went away must not end up in front of the next client's
+         */
+        reset_capture(out_fd);
+        reset_capture(err_fd);
+
+        int32_t status = run_builtin(argc, argv);
+        if (status == -1)
+            status = run_external(argc, argv);
+
+        if (send_capture(client_fd, FRAME_STDOUT, out_fd) != 0 ||
+            send_capture(client_fd, FRAME_STDERR, err_fd) != 0 ||
+            send_frame(client_fd, FRAME_EXIT, &status, sizeof(status)) != 0) {
+            free(batch);
+            return -1;
+        }
+    }
+
+    free(batch);
+
+    if (send_frame(client_fd, FRAME_DONE, NULL, 0) != 0)
+        return -1;
+    return keep_open;
+}
+
+static void* worker_main(void* arg) {
+    struct server* srv = arg;
+
+    int out_fd = memfd_create("shell-stdout", MFD_CLOEXEC);
+    int err_fd = memfd_create("shell-stderr", MFD_CLOEXEC);
+    if (out_fd < 0 || err_fd < 0) {
+        print_err("server: memfd_create failed\n");
+        return NULL;
+    }
+    print_set_output(out_fd, err_fd);
+
+    while (1) {
+        int client_fd = queue_pop(&srv->queue);
+
+        if (handle_request(client_fd, out_fd, err_fd) != 0) {
+            close(client_fd);
+            continue;
+        }
+
+        // hand the connection back to the epoll loop for its next batch
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = client_fd};
+        if (epoll_ctl(srv->epoll_fd, EPOLL_CTL_MOD, client_fd, &ev) != 0)
+            close(client_fd);
+    }
+
+    return NULL;
+}
+
+static int open_listener(const char* sock_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (str_len(sock_path) >= sizeof(addr.sun_path)) {
+        print_err("server: socket path too long: %s\n", sock_path);
+        return -1;
+    }
+    memcpy(addr.sun_path, sock_path, str_len(sock_path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        print_err("server: could not create socket\n");
+        return -1;
+    }
+
+    // clear a stale socket from a previous run, but never anything else living at that path
+    struct stat st;
+    if (lstat(sock_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            print_err("server: %s exists and is not a socket\n", sock_path);
+            close(fd);
+            return -1;
+        }
+        unlink(sock_path);
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        print_err("server: could not bind %s\n", sock_path);
+        close(fd);
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) != 0) {
+        print_err("server: listen failed\n");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+int server_run(const char* sock_path) {
+    static struct server srv;
+
+    signal(SIGPIPE, SIG_IGN); // a vanished client shows up as EPIPE instead
+
+    srv.listen_fd = open_listener(sock_path);
+    if (srv.listen_fd < 0)
+        return 1;
+
+    srv.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (srv.epoll_fd < 0) {
+        print_err("server: epoll_create1 failed\n");
+        return 1;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = srv.listen_fd};
+    epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.listen_fd, &ev);
+
+    pthread_mutex_init(&srv.queue.lock, NULL);
+    pthread_cond_init(&srv.queue.not_empty, NULL);
+
+    for (int i = 0; i < SERVER_WORKERS; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, &srv) != 0) {
+            print_err("server: could not start worker\n");
+            return 1;
+        }
+        pthread_detach(tid);
+    }
+
+    print("server: listening on %s\n", sock_path);
+
+    struct epoll_event events[64];
+    while (1) {
+        int n = epoll_wait(srv.epoll_fd, events, 64, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            print_err("server: epoll_wait failed\n");
+            return 1;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd != srv.listen_fd) {
+                // oneshot: the fd stays disarmed until its worker re-arms it
+                queue_push(&srv.queue, fd);
+                continue;
+            }
+
+            int client_fd = accept4(srv.listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (client_fd < 0)
+                continue;
+
+            /*
+             * epoll only says the first byte is here, the worker then reads the rest of the
+             * frame blocking. a client that stops halfway would hold that worker forever,
+             * so its reads and writes give up after a while and the connection is dropped
+             */
+            struct timeval timeout = {SERVER_IO_TIMEOUT, 0};
+            setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            struct epoll_event cev = {.events = EPOLLIN | EPOLLONESHOT, .data.fd = client_fd};
+            if (epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, client_fd, &cev) != 0)
+                close(client_fd);
+        }
+    }
+}
+
+int client_run(const char* sock_path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if (str_len(sock_path) >= sizeof(addr.sun_path)) {
+        print_err("client: socket path too long: %s\n", sock_path);
+        return 1;
+    }
+    memcpy(addr.sun_path, sock_path, str_len(sock_path) + 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        print_err("client: could not connect to %s\n", sock_path);
+        return 1;
+    }
+
+    // the whole of stdin is sent as a single batch
+    size_t cap  = IO_BUF_SIZE;
+    size_t len  = 0;
+    char* batch = malloc(cap);
+    ssize_t n;
+    while (batch && (n = read(STDIN_FILENO, batch + len, cap - len)) > 0) {
+        len += n;
+        if (len == cap) {
+            cap *= 2;
+            char* grown = realloc(batch, cap);
+            if (!grown) {
+                free(batch);
+                batch = NULL;
+                break;
+            }
+            batch = grown;
+        }
+    }
+    if (!batch || len > SERVER_MAX_BATCH) {
+        print_err("client: batch too large\n");
+        free(batch);
+        return 1;
+    }
+
+    uint32_t batch_len = len;
+    if (write_all(fd, &batch_len, sizeof(batch_len)) != 0 || write_all(fd, batch, len) != 0) {
+        print_err("client: failed to send batch\n");
+        free(batch);
+        return 1;
+    }
+    free(batch);
+
+    int32_t status = 0;
+    char buf[IO_BUF_SIZE];
+
+    while (1) {
+        char hdr[5];
+        if (read_all(fd, hdr, sizeof(hdr)) != 1)
+            break;
+
+        uint32_t frame_len;
+        memcpy(&frame_len, hdr + 1, sizeof(frame_len));
+
+        if (hdr[0] == FRAME_DONE)
+            break;
+
+        int dst = hdr[0] == FRAME_STDERR ? STDERR_FILENO : STDOUT_FILENO;
+        while (frame_len > 0) {
+            size_t chunk = frame_len < sizeof(buf) ? frame_len : sizeof(buf);
+            if (read_all(fd, buf, chunk) != 1) {
+                close(fd);
+                return 1;
+            }
+            if (hdr[0] == FRAME_EXIT && chunk == sizeof(status))
+                memcpy(&status, buf, sizeof(status));
+            else if (hdr[0] != FRAME_EXIT)
+                write_all(dst, buf, chunk);
+            frame_len -= chunk;
+        }
+    }
+
+    close(fd);
+    return status;
+}
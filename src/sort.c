@@ -0,0 +1,938 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "include/command.h"
+#include "include/input.h"
+#include "include/path.h"
+#include "include/print.h"
+#include "include/scan.h"
+#include "include/tokenize.h"
+
+#define SORT_DEFAULT_BUDGET (256L * 1024 * 1024)
+#define SORT_MIN_BUDGET (64L * 1024)
+#define SORT_PARALLEL_MIN 65536
+#define SORT_MAX_THREADS 8
+#define SORT_WRITE_BUF (64 * 1024)
+#define SORT_RUN_BUF_MIN (16 * 1024)
+#define SORT_RUN_BUF_MAX (1024 * 1024)
+#define SORT_MAX_FANIN 64
+
+struct sort_flags {
+    int reverse;
+    int numeric;
+    int unique;
+    int key_field; // 1-based, 0 means the whole line
+    char separator; // 0 means runs of blanks
+    long budget;
+    int file_idx;
+};
+
+/*
+ * one line of the input buffer. the key is cached so most comparisons never touch
+ * the text: its first 8 bytes big-endian (so integer order is byte order), or its
+ * numeric value for -n
+ */
+struct sort_rec {
+    uint64_t off;
+    uint32_t len;
+    uint32_t key_off; // relative to the start of the line
+    uint32_t key_len;
+    union {
+        uint64_t prefix;
+        double num;
+    } key;
+};
+
+static int is_blank(char c) {
+    return c == ' ' || c == '\t';
+}
+
+static void key_bounds(const struct sort_flags* flags, const char* line, size_t len, size_t* key_off,
+                       size_t* key_len) {
+    size_t i = 0;
+
+    if (flags->key_field > 1 && flags->separator) {
+        for (int field = 1; field < flags->key_field && i < len; i++) {
+            if (line[i] == flags->separator)
+                field++;
+            if (field == flags->key_field) {
+                i++;
+                break;
+            }
+        }
+    }
+    else if (flags->key_field > 1) {
+        // as in sort(1), a field's leading blanks belong to it
+        for (int field = 1; field < flags->key_field && i < len; field++) {
+            while (i < len && is_blank(line[i]))
+                i++;
+            while (i < len && !is_blank(line[i]))
+                i++;
+        }
+    }
+
+    if (i > len)
+        i = len;
+    *key_off = i;
+    *key_len = len - i;
+}
+
+// bounded, so it can't run on into the next line the way strtod would
+static double parse_number(const char* s, size_t len) {
+    size_t i = 0;
+    while (i < len && is_blank(s[i]))
+        i++;
+
+    int negative = 0;
+    if (i < len && (s[i] == '-' || s[i] == '+'))
+        negative = (s[i++] == '-');
+
+    double value = 0;
+    while (i < len && s[i] >= '0' && s[i] <= '9')
+        value = value * 10 + (s[i++] - '0');
+
+    if (i < len && s[i] == '.') {
+        double scale = 0.1;
+        for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+            value += (s[i] - '0') * scale;
+            scale *= 0.1;
+        }
+    }
+
+    return negative ? -value : value;
+}
+
+static void make_rec(const struct sort_flags* flags, const char* base, size_t off, size_t len, struct sort_rec* rec) {
+    const char* line = base + off;
+    size_t key_off, key_len;
+    key_bounds(flags, line, len, &key_off, &key_len);
+
+    rec->off     = off;
+    rec->len     = len;
+    rec->key_off = key_off;
+    rec->key_len = key_len;
+
+    if (flags->numeric) {
+        rec->key.num = parse_number(line + key_off, key_len);
+        return;
+    }
+
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; i++) {
+        prefix <<= 8;
+        if (i < key_len)
+            prefix |= (unsigned char)line[key_off + i];
+    }
+    rec->key.prefix = prefix;
+}
+
+static int cmp_bytes(const char* a, size_t a_len, const char* b, size_t b_len) {
+    size_t n = a_len < b_len ? a_len : b_len;
+    int r    = memcmp(a, b, n);
+    if (r != 0)
+        return r;
+    return (a_len > b_len) - (a_len < b_len);
+}
+
+static int cmp_key(const struct sort_flags* flags, const char* base_a, const struct sort_rec* a, const char* base_b,
+                   const struct sort_rec* b) {
+    if (flags->numeric)
+        return (a->key.num > b->key.num) - (a->key.num < b->key.num);
+
+    if (a->key.prefix != b->key.prefix)
+        return a->key.prefix < b->key.prefix ? -1 : 1;
+
+    return cmp_bytes(base_a + a->off + a->key_off, a->key_len, base_b + b->off + b->key_off, b->key_len);
+}
+
+// keys first, then (unless -u) the whole line as a last resort, like sort(1)
+static int cmp_recs(const struct sort_flags* flags, const char* base_a, const struct sort_rec* a, const char* base_b,
+                    const struct sort_rec* b) {
+    int r = cmp_key(flags, base_a, a, base_b, b);
+    if (r == 0 && !flags->unique)
+        r = cmp_bytes(base_a + a->off, a->len, base_b + b->off, b->len);
+    return flags->reverse ? -r : r;
+}
+
+struct sort_job {
+    const struct sort_flags* flags;
+    const char* base;
+    struct sort_rec* recs;
+    struct sort_rec* tmp;
+    size_t n;
+    size_t mid; // for merge jobs: [0, mid) and [mid, n) are already sorted
+};
+
+static void merge_runs(const struct sort_job* job, const struct sort_rec* src, struct sort_rec* dst) {
+    size_t i = 0, j = job->mid, k = 0;
+    while (i < job->mid && j < job->n) {
+        if (cmp_recs(job->flags, job->base, &src[j], job->base, &src[i]) < 0)
+            dst[k++] = src[j++];
+        else
+            dst[k++] = src[i++];
+    }
+    while (i < job->mid)
+        dst[k++] = src[i++];
+    while (j < job->n)
+        dst[k++] = src[j++];
+}
+
+// stable merge sort of recs[0, n) using tmp[0, n) as scratch
+static void merge_sort(const struct sort_flags* flags, const char* base, struct sort_rec* recs, struct sort_rec* tmp,
+                       size_t n) {
+    if (n <= 16) {
+        for (size_t i = 1; i < n; i++) {
+            struct sort_rec r = recs[i];
+            size_t j          = i;
+            while (j > 0 && cmp_recs(flags, base, &r, base, &recs[j - 1]) < 0) {
+                recs[j] = recs[j - 1];
+                j--;
+            }
+            recs[j] = r;
+        }
+        return;
+    }
+
+    size_t mid = n / 2;
+    merge_sort(flags, base, recs, tmp, mid);
+    merge_sort(flags, base, recs + mid, tmp + mid, n - mid);
+
+    struct sort_job job = {flags, base, recs, tmp, n, mid};
+    merge_runs(&job, recs, tmp);
+    memcpy(recs, tmp, n * sizeof(*recs));
+}
+
+static void* sort_worker(void* arg) {
+    struct sort_job* job = arg;
+    merge_sort(job->flags, job->base, job->recs, job->tmp, job->n);
+    return NULL;
+}
+
+static void* merge_worker(void* arg) {
+    struct sort_job* job = arg;
+    merge_runs(job, job->recs, job->tmp);
+    return NULL;
+}
+
+// runs every job on its own thread (or inline if one can't be started) and waits for all of them
+static void run_jobs(struct sort_job* jobs, int n, void* (*fn)(void*)) {
+    pthread_t threads[SORT_MAX_THREADS];
+    int started[SORT_MAX_THREADS];
+
+    for (int i = 1; i < n; i++)
+        started[i] = pthread_create(&threads[i], NULL, fn, &jobs[i]) == 0;
+
+    fn(&jobs[0]);
+    for (int i = 1; i < n; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+        else
+            fn(&jobs[i]);
+    }
+}
+
+/*
+ * each thread sorts one slice, then adjacent slices are merged pairwise in parallel
+ * rounds until one run is left; returns the array holding the result (recs or tmp)
+ */
+static struct sort_rec* parallel_sort(const struct sort_flags* flags, const char* base, struct sort_rec* recs,
+                                      struct sort_rec* tmp, size_t n) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n_parts = n < SORT_PARALLEL_MIN || n_cpus < 2 ? 1 : (n_cpus > SORT_MAX_THREADS ? SORT_MAX_THREADS : n_cpus);
+
+    size_t bounds[SORT_MAX_THREADS + 1];
+    for (int i = 0; i <= n_parts; i++)
+        bounds[i] = n * i / n_parts;
+
+    struct sort_job jobs[SORT_MAX_THREADS];
+    for (int i = 0; i < n_parts; i++) {
+        struct sort_job job = {flags, base, recs + bounds[i], tmp + bounds[i], bounds[i + 1] - bounds[i], 0};
+        jobs[i]             = job;
+    }
+    run_jobs(jobs, n_parts, sort_worker);
+
+    struct sort_rec* src = recs;
+    struct sort_rec* dst = tmp;
+
+    while (n_parts > 1) {
+        int n_jobs = 0;
+        for (int i = 0; i < n_parts; i += 2) {
+            size_t lo  = bounds[i];
+            size_t mid = bounds[i + 1];
+            size_t hi  = (i + 2 <= n_parts) ? bounds[i + 2] : mid;
+
+            struct sort_job job = {flags, base, src + lo, dst + lo, hi - lo, i + 1 < n_parts ? mid - lo : hi - lo};
+            jobs[n_jobs++]      = job;
+        }
+        run_jobs(jobs, n_jobs, merge_worker);
+
+        int merged = 0;
+        for (int i = 0; i < n_parts; i += 2)
+            bounds[merged++] = bounds[i];
+        bounds[merged] = n;
+        n_parts        = merged;
+
+        struct sort_rec* swap = src;
+        src                   = dst;
+        dst                   = swap;
+    }
+
+    return src;
+}
+
+// output batched into large writes, either to the terminal (fd -1) or to a run file
+struct line_writer {
+    int fd;
+    size_t len;
+    char buf[SORT_WRITE_BUF];
+};
+
+static int writer_flush(struct line_writer* w) {
+    if (w->fd < 0) {
+        print_bytes(w->buf, w->len);
+        w->len = 0;
+        return 0;
+    }
+
+    const char* p = w->buf;
+    while (w->len > 0) {
+        ssize_t n = write(w->fd, p, w->len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        w->len -= n;
+    }
+    return 0;
+}
+
+static int writer_line(struct line_writer* w, const char* line, size_t len) {
+    while (len + 1 > sizeof(w->buf) - w->len) {
+        size_t part = sizeof(w->buf) - w->len;
+        if (part > len)
+            part = len;
+        memcpy(w->buf + w->len, line, part);
+        w->len += part;
+        line += part;
+        len -= part;
+        if (writer_flush(w) != 0)
+            return -1;
+    }
+
+    memcpy(w->buf + w->len, line, len);
+    w->len += len;
+    w->buf[w->len++] = '\n';
+    return 0;
+}
+
+// sorts the complete lines in text[0, len) (every one newline terminated) and writes them out
+static int sort_and_write(const struct sort_flags* flags, const char* text, size_t len, struct line_writer* w) {
+    size_t n_lines = 0;
+    for (const char* p = text; (p = memchr(p, '\n', text + len - p)) != NULL; p++)
+        n_lines++;
+
+    struct sort_rec* recs = malloc(n_lines * sizeof(*recs) + 1);
+    struct sort_rec* tmp  = malloc(n_lines * sizeof(*tmp) + 1);
+    if (!recs || !tmp) {
+        free(recs);
+        free(tmp);
+        return -1;
+    }
+
+    size_t off = 0;
+    for (size_t i = 0; i < n_lines; i++) {
+        const char* nl = memchr(text + off, '\n', len - off);
+        make_rec(flags, text, off, nl - (text + off), &recs[i]);
+        off = nl - text + 1;
+    }
+
+    struct sort_rec* sorted = parallel_sort(flags, text, recs, tmp, n_lines);
+
+    int ret                     = 0;
+    const struct sort_rec* prev = NULL;
+    for (size_t i = 0; i < n_lines && ret == 0; i++) {
+        if (flags->unique && prev && cmp_key(flags, text, prev, text, &sorted[i]) == 0)
+            continue;
+        prev = &sorted[i];
+        ret  = writer_line(w, text + sorted[i].off, sorted[i].len);
+    }
+
+    free(recs);
+    free(tmp);
+    return ret;
+}
+
+// unlinked straight away, so the runs disappear however the command ends
+static int open_run_file(void) {
+    const char* tmp_dir = getenv("TMPDIR");
+
+    struct path_buf path;
+    if (path_init(&path, tmp_dir && tmp_dir[0] ? tmp_dir : "/tmp") != 0)
+        return -1;
+    if (path_push(&path, "sort.XXXXXX") == PATH_PUSH_FAILED) {
+        path_free(&path);
+        return -1;
+    }
+
+    int fd = mkstemp(path.data);
+    if (fd >= 0)
+        unlink(path.data);
+
+    path_free(&path);
+    return fd;
+}
+
+// a sorted run: one stretch of the run file
+struct run_seg {
+    off_t off;
+    off_t len;
+};
+
+// every run lives in the same temporary file, so spilling needs one fd however many runs there are
+struct run_list {
+    int fd; // -1 until the first spill
+    off_t end;
+    struct run_seg* segs;
+    int n;
+    int cap;
+};
+
+static int add_run(struct run_list* runs, off_t off, off_t len) {
+    if (runs->n == runs->cap) {
+        int cap              = runs->cap ? runs->cap * 2 : 16;
+        struct run_seg* segs = realloc(runs->segs, cap * sizeof(*segs));
+        if (!segs)
+            return -1;
+        runs->segs = segs;
+        runs->cap  = cap;
+    }
+
+    struct run_seg seg    = {off, len};
+    runs->segs[runs->n++] = seg;
+    runs->end             = off + len;
+    return 0;
+}
+
+static int spill_run(const struct sort_flags* flags, const char* text, size_t len, struct run_list* runs) {
+    if (runs->fd < 0 && (runs->fd = open_run_file()) < 0) {
+        print_err("sort: cannot create temporary file\n");
+        return -1;
+    }
+
+    struct line_writer* w = malloc(sizeof(*w));
+    if (!w)
+        return -1;
+    w->fd  = runs->fd;
+    w->len = 0;
+
+    int ret = sort_and_write(flags, text, len, w);
+    if (ret == 0)
+        ret = writer_flush(w);
+    free(w);
+
+    off_t end = lseek(runs->fd, 0, SEEK_CUR);
+    if (ret == 0 && (end < 0 || add_run(runs, runs->end, end - runs->end) != 0))
+        ret = -1;
+
+    if (ret != 0)
+        print_err("sort: error writing temporary file\n");
+    return ret;
+}
+
+// reads a sorted run back one line at a time
+struct run_reader {
+    int fd;
+    off_t pos;  // next byte of the run to read
+    off_t left; // bytes of the run not read yet
+    char* buf;
+    size_t cap;
+    size_t start;
+    size_t end;
+    int eof;
+    int exhausted;
+    struct sort_rec cur; // offsets relative to buf
+};
+
+static int reader_next(const struct sort_flags* flags, struct run_reader* r) {
+    while (1) {
+        char* nl = memchr(r->buf + r->start, '\n', r->end - r->start);
+        if (nl) {
+            size_t len = nl - (r->buf + r->start);
+            make_rec(flags, r->buf, r->start, len, &r->cur);
+            r->start += len + 1;
+            return 0;
+        }
+
+        if (r->eof) {
+            r->exhausted = 1;
+            return 0;
+        }
+
+        // keep the partial line, make room behind it (growing only for a line longer than the buffer)
+        memmove(r->buf, r->buf + r->start, r->end - r->start);
+        r->end -= r->start;
+        r->start = 0;
+
+        if (r->end == r->cap) {
+            char* grown = realloc(r->buf, r->cap * 2);
+            if (!grown)
+                return -1;
+            r->buf = grown;
+            r->cap *= 2;
+        }
+
+        size_t want = r->cap - r->end;
+        if ((off_t)want > r->left)
+            want = r->left;
+
+        ssize_t n = want > 0 ? pread(r->fd, r->buf + r->end, want, r->pos) : 0;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            r->eof = 1;
+        r->end += n;
+        r->pos += n;
+        r->left -= n;
+    }
+}
+
+struct loser_tree {
+    const struct sort_flags* flags;
+    struct run_reader* runs;
+    int k;
+    int* tree; // tree[0] is the overall winner, tree[1..k) the loser of each match
+};
+
+// does run a come out before run b; exhausted runs lose to everything
+static int lt_beats(const struct loser_tree* lt, int a, int b) {
+    const struct run_reader* ra = &lt->runs[a];
+    const struct run_reader* rb = &lt->runs[b];
+    if (ra->exhausted || rb->exhausted)
+        return !ra->exhausted;
+
+    int r = cmp_recs(lt->flags, ra->buf, &ra->cur, rb->buf, &rb->cur);
+    return r < 0 || (r == 0 && a < b);
+}
+
+static int lt_build(struct loser_tree* lt, int node) {
+    if (node >= lt->k)
+        return node - lt->k;
+
+    int left  = lt_build(lt, 2 * node);
+    int right = lt_build(lt, 2 * node + 1);
+
+    if (lt_beats(lt, left, right)) {
+        lt->tree[node] = right;
+        return left;
+    }
+    lt->tree[node] = left;
+    return right;
+}
+
+// the winner's run has advanced; replay its path to the root
+static void lt_replay(struct loser_tree* lt) {
+    int winner = lt->tree[0];
+    for (int node = (winner + lt->k) / 2; node >= 1; node /= 2) {
+        if (lt_beats(lt, lt->tree[node], winner)) {
+            int swap       = lt->tree[node];
+            lt->tree[node] = winner;
+            winner         = swap;
+        }
+    }
+    lt->tree[0] = winner;
+}
+
+// merges runs segs[0, k) of fd into w
+static int merge_run_group(const struct sort_flags* flags, int fd, const struct run_seg* segs, int k,
+                           struct line_writer* w) {
+    // split the budget between the run buffers
+    size_t run_buf = flags->budget / k;
+    if (run_buf < SORT_RUN_BUF_MIN)
+        run_buf = SORT_RUN_BUF_MIN;
+    if (run_buf > SORT_RUN_BUF_MAX)
+        run_buf = SORT_RUN_BUF_MAX;
+
+    struct run_reader* readers = calloc(k, sizeof(*readers));
+    int* tree                  = malloc(k * sizeof(*tree));
+    char* prev                 = NULL;
+    size_t prev_cap            = 0;
+    int ret                    = -1;
+
+    if (!readers || !tree)
+        goto out;
+
+    for (int i = 0; i < k; i++) {
+        readers[i].fd   = fd;
+        readers[i].pos  = segs[i].off;
+        readers[i].left = segs[i].len;
+        readers[i].cap  = run_buf;
+        readers[i].buf  = malloc(run_buf);
+        if (!readers[i].buf || reader_next(flags, &readers[i]) != 0)
+            goto out;
+    }
+
+    struct loser_tree lt = {flags, readers, k, tree};
+    tree[0]              = lt_build(&lt, 1);
+
+    // -u needs the last line written, copied out since its reader's buffer moves on
+    struct sort_rec prev_rec;
+    int have_prev = 0;
+
+    while (!readers[tree[0]].exhausted) {
+        struct run_reader* r = &readers[tree[0]];
+
+        if (!(flags->unique && have_prev && cmp_key(flags, prev, &prev_rec, r->buf, &r->cur) == 0)) {
+            if (writer_line(w, r->buf + r->cur.off, r->cur.len) != 0)
+                goto out;
+
+            if (flags->unique) {
+                if (r->cur.len + 1 > prev_cap) {
+                    prev_cap    = r->cur.len + 1;
+                    char* grown = realloc(prev, prev_cap);
+                    if (!grown)
+                        goto out;
+                    prev = grown;
+                }
+                memcpy(prev, r->buf + r->cur.off, r->cur.len);
+                make_rec(flags, prev, 0, r->cur.len, &prev_rec);
+                have_prev = 1;
+            }
+        }
+
+        if (reader_next(flags, r) != 0)
+            goto out;
+        lt_replay(&lt);
+    }
+
+    ret = writer_flush(w);
+
+out:
+    if (readers) {
+        for (int i = 0; i < k; i++)
+            free(readers[i].buf);
+    }
+    free(readers);
+    free(tree);
+    free(prev);
+    return ret;
+}
+
+/*
+ * merges at most fan_in runs at a time, so open buffers stay within the budget however
+ * many runs there are. while more are left, groups are merged into the runs of a second
+ * file and the two files swap roles; the last pass writes the output
+ */
+static int merge_run_files(const struct sort_flags* flags, struct run_list* runs) {
+    int fan_in = flags->budget / SORT_RUN_BUF_MIN;
+    if (fan_in > SORT_MAX_FANIN)
+        fan_in = SORT_MAX_FANIN;
+    if (fan_in < 2)
+        fan_in = 2;
+
+    struct line_writer* w = malloc(sizeof(*w));
+    if (!w)
+        return -1;
+
+    while (runs->n > fan_in) {
+        struct run_list next = {open_run_file(), 0, NULL, 0, 0};
+        if (next.fd < 0) {
+            print_err("sort: cannot create temporary file\n");
+            free(w);
+            return -1;
+        }
+
+        for (int i = 0; i < runs->n; i += fan_in) {
+            int k  = runs->n - i < fan_in ? runs->n - i : fan_in;
+            w->fd  = next.fd;
+            w->len = 0;
+
+            off_t end;
+            if (merge_run_group(flags, runs->fd, runs->segs + i, k, w) != 0 ||
+                (end = lseek(next.fd, 0, SEEK_CUR)) < 0 || add_run(&next, next.end, end - next.end) != 0) {
+                print_err("sort: error writing temporary file\n");
+                close(next.fd);
+                free(next.segs);
+                free(w);
+                return -1;
+            }
+        }
+
+        close(runs->fd);
+        free(runs->segs);
+        *runs = next;
+    }
+
+    w->fd  = -1;
+    w->len = 0;
+
+    int ret = merge_run_group(flags, runs->fd, runs->segs, runs->n, w);
+    free(w);
+    return ret;
+}
+
+// what sorting a buffer costs per line on top of its text: a record in recs and one in tmp
+#define SORT_REC_COST (2 * sizeof(struct sort_rec))
+
+// the longest run of whole lines at the start of data[0, part) whose text and records fit in room
+static size_t fit_lines(const char* data, size_t part, size_t room, size_t* lines) {
+    size_t take = 0;
+    const char* nl;
+
+    *lines = 0;
+    while ((nl = memchr(data + take, '\n', part - take)) != NULL) {
+        size_t end = nl - data + 1;
+        if (end + (*lines + 1) * SORT_REC_COST > room)
+            break;
+        take = end;
+        (*lines)++;
+    }
+    return take;
+}
+
+// sorts and spills every complete line in text, keeping the unfinished one at the front
+static int spill_complete(const struct sort_flags* flags, char* text, size_t* len, struct run_list* runs) {
+    char* nl = memrchr(text, '\n', *len);
+    if (!nl)
+        return 0;
+
+    size_t whole = nl - text + 1;
+    if (spill_run(flags, text, whole, runs) != 0)
+        return -1;
+
+    memmove(text, text + whole, *len - whole);
+    *len -= whole;
+    return 0;
+}
+
+/*
+ * input is gathered into one buffer for as long as its text plus the records needed
+ * to sort it fit the memory budget. if everything fits it's sorted and printed
+ * directly; otherwise every full buffer is sorted and spilled to a temporary run
+ * file, and the runs are k-way merged at the end
+ */
+static int sort_files(const struct sort_flags* flags, int n_files, char* files[]) {
+    const size_t budget = flags->budget;
+
+    size_t cap     = budget < INPUT_BUF_SIZE ? budget : INPUT_BUF_SIZE;
+    size_t len     = 0;
+    size_t n_lines = 0; // complete lines in text
+    char* text     = malloc(cap);
+    int ret        = -1;
+
+    struct run_list runs = {-1, 0, NULL, 0, 0};
+
+    if (!text) {
+        print_err("sort: out of memory\n");
+        return -1;
+    }
+
+    for (int f = 0; f < n_files; f++) {
+        struct input in;
+        if (input_open(&in, files[f]) != 0) {
+            print_err("sort: cannot open file: %s\n", files[f]);
+            goto out;
+        }
+
+        const char* data;
+        ssize_t n;
+        while ((n = input_next(&in, &data)) > 0) {
+            while (n > 0) {
+                if (len == cap) {
+                    // a single line longer than the whole budget has to be let through
+                    size_t new_cap = cap * 2;
+                    if (cap < budget && new_cap > budget)
+                        new_cap = budget;
+
+                    char* grown = realloc(text, new_cap);
+                    if (!grown) {
+                        print_err("sort: out of memory\n");
+                        input_close(&in);
+                        goto out;
+                    }
+                    text = grown;
+                    cap  = new_cap;
+                    continue;
+                }
+
+                size_t part  = cap - len < (size_t)n ? cap - len : (size_t)n;
+                size_t lines = scan_count_newlines(data, part);
+                size_t used  = len + n_lines * SORT_REC_COST;
+                int full     = 0;
+
+                if (used + part + lines * SORT_REC_COST > budget) {
+                    size_t room = used < budget ? budget - used : 0;
+                    size_t take = fit_lines(data, part, room, &lines);
+
+                    if (take > 0 || n_lines > 0) {
+                        part = take;
+                        full = 1;
+                    }
+                    else {
+                        // nothing complete to spill yet: take up to the end of this line
+                        const char* nl = memchr(data, '\n', part);
+                        part           = nl ? (size_t)(nl - data + 1) : part;
+                        lines          = nl ? 1 : 0;
+                    }
+                }
+
+                memcpy(text + len, data, part);
+                len += part;
+                n_lines += lines;
+                data += part;
+                n -= part;
+
+                if (full) {
+                    if (spill_complete(flags, text, &len, &runs) != 0) {
+                        input_close(&in);
+                        goto out;
+                    }
+                    n_lines = 0;
+                }
+            }
+        }
+        input_close(&in);
+
+        if (n < 0) {
+            print_err("sort: error reading file: %s\n", files[f]);
+            goto out;
+        }
+
+        // a missing final newline still ends the file's last line
+        if (len > 0 && text[len - 1] != '\n') {
+            if (len == cap) {
+                char* grown = realloc(text, cap + 1);
+                if (!grown)
+                    goto out;
+                text = grown;
+                cap++;
+            }
+            text[len++] = '\n';
+        }
+    }
+
+    if (runs.n == 0) {
+        struct line_writer* w = malloc(sizeof(*w));
+        if (!w)
+            goto out;
+        w->fd  = -1;
+        w->len = 0;
+        ret    = sort_and_write(flags, text, len, w);
+        if (ret == 0)
+            ret = writer_flush(w);
+        free(w);
+        goto out;
+    }
+
+    if (len > 0 && spill_run(flags, text, len, &runs) != 0)
+        goto out;
+
+    free(text);
+    text = NULL;
+    ret  = merge_run_files(flags, &runs);
+
+out:
+    if (runs.fd >= 0)
+        close(runs.fd);
+    free(runs.segs);
+    free(text);
+    if (ret != 0 && runs.n > 0)
+        print_err("sort: failed\n");
+    return ret;
+}
+
+static int parse_size(const char* s, long* out) {
+    const char* end;
+    long n;
+    if (parse_nonneg(s, &n, &end) != 0)
+        return -1;
+
+    // -S accepts a K/M/G suffix
+    if (*end == 'K' || *end == 'k')
+        n *= 1024, end++;
+    else if (*end == 'M' || *end == 'm')
+        n *= 1024 * 1024, end++;
+    else if (*end == 'G' || *end == 'g')
+        n *= 1024L * 1024 * 1024, end++;
+
+    if (*end != '\0')
+        return -1;
+
+    *out = n;
+    return 0;
+}
+
+static struct sort_flags parse_sort_flags(int argc, char* argv[]) {
+    struct sort_flags flags = {0, 0, 0, 0, 0, SORT_DEFAULT_BUDGET, 1};
+
+    while (flags.file_idx < argc && argv[flags.file_idx][0] == '-') {
+        const char* flag = argv[flags.file_idx] + 1;
+
+        for (int i = 0; flag[i] != '\0'; i++) {
+            if (flag[i] == 'r') {
+                flags.reverse = 1;
+            }
+            else if (flag[i] == 'n') {
+                flags.numeric = 1;
+            }
+            else if (flag[i] == 'u') {
+                flags.unique = 1;
+            }
+            else if (flag[i] == 'k' || flag[i] == 't' || flag[i] == 'S') {
+                // the value is either the rest of this word or the next one
+                const char* value = flag[i + 1] != '\0' ? flag + i + 1 : argv[++flags.file_idx];
+                long n;
+
+                if (value == NULL) {
+                    print_err("sort: option -%c needs a value\n", flag[i]);
+                    flags.file_idx = -1;
+                    return flags;
+                }
+
+                if (flag[i] == 't') {
+                    flags.separator = value[0];
+                }
+                else if (parse_size(value, &n) != 0 || (flag[i] == 'k' && n < 1)) {
+                    print_err("sort: invalid value for -%c: %s\n", flag[i], value);
+                    flags.file_idx = -1;
+                    return flags;
+                }
+                else if (flag[i] == 'k') {
+                    flags.key_field = n;
+                }
+                else {
+                    flags.budget = n < SORT_MIN_BUDGET ? SORT_MIN_BUDGET : n;
+                }
+                break;
+            }
+            else {
+                print_err("sort: unknown flag -%s\n", flag);
+                flags.file_idx = -1;
+                return flags;
+            }
+        }
+        flags.file_idx++;
+    }
+
+    return flags;
+}
+
+int builtin_sort(int argc, char* argv[]) {
+    struct sort_flags flags = parse_sort_flags(argc, argv);
+    if (flags.file_idx < 0 || flags.file_idx >= argc) {
+        print_err("usage: sort [-r] [-n] [-u] [-k <field>] [-t <char>] [-S <bytes>] <file> ...\n");
+        return 0;
+    }
+
+    if (sort_files(&flags, argc - flags.file_idx, argv + flags.file_idx) != 0)
+        return 1;
+    return 0;
+}
@@ -1,3 +1,6 @@
+#include <errno.h>
+#include <stdlib.h>
+
 #include "include/tokenize.h"
 
 int str_cmp(const char* s1, const char* s2) {
@@ -14,10 +17,26 @@ int str_cmp(const char* s1, const char* s2) {
     return *s1 == *s2;
 }
 
+int parse_nonneg(const char* s, long* out, const char** rest) {
+    char* end;
+    errno  = 0;
+    long n = strtol(s, &end, 10);
+    if (errno != 0 || end == s || n < 0)
+        return -1;
+    if (rest == NULL && *end != '\0')
+        return -1;
+
+    if (rest != NULL)
+        *rest = end;
+    *out = n;
+    return 0;
+}
+
 int tokenize(char* input, char* argv[]) {
     int argc = 0;
 
-    while (*input != '\0') {
+    // keep room for the terminating NULL, extra words are dropped
+    while (*input != '\0' && argc < MAX_TOKENS - 1) {
 
         while (*input == ' ' || *input == '\t' || *input == '\n')
             input++;
@@ -0,0 +1,187 @@
+#include <pthread.h>
+#include <unistd.h>
+
+#include "include/command.h"
+#include "include/input.h"
+#include "include/print.h"
+#include "include/scan.h"
+
+#define WC_PARALLEL_THRESHOLD (64 * 1024 * 1024)
+#define WC_MAX_THREADS 8
+
+struct wc_flags {
+    int lines;
+    int words;
+    int bytes;
+    int file_idx;
+};
+
+struct wc_counts {
+    size_t lines;
+    size_t words;
+    size_t bytes;
+};
+
+// one slice of a mapped file, counted on its own thread
+struct wc_chunk {
+    const char* data;
+    size_t len;
+    struct wc_counts counts;
+};
+
+static void* count_chunk(void* arg) {
+    struct wc_chunk* chunk = arg;
+    int in_space           = 1;
+
+    chunk->counts.lines = scan_count_newlines(chunk->data, chunk->len);
+    chunk->counts.words = scan_count_words(chunk->data, chunk->len, &in_space);
+    chunk->counts.bytes = chunk->len;
+    return NULL;
+}
+
+/*
+ * each chunk counts its words as if it started after whitespace, so a word that
+ * straddles a chunk edge is counted on both sides; those are subtracted when merging
+ */
+static struct wc_counts count_parallel(const char* data, size_t len) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n       = n_cpus < 1 ? 1 : (n_cpus > WC_MAX_THREADS ? WC_MAX_THREADS : (int)n_cpus);
+
+    struct wc_chunk chunks[WC_MAX_THREADS];
+    pthread_t threads[WC_MAX_THREADS];
+    int started[WC_MAX_THREADS];
+
+    size_t chunk_len = len / n;
+    for (int i = 0; i < n; i++) {
+        chunks[i].data = data + i * chunk_len;
+        chunks[i].len  = (i == n - 1) ? len - i * chunk_len : chunk_len;
+        started[i]     = (i > 0 && pthread_create(&threads[i], NULL, count_chunk, &chunks[i]) == 0);
+    }
+
+    // this thread takes the first chunk, plus any a thread couldn't be started for
+    for (int i = 0; i < n; i++) {
+        if (!started[i])
+            count_chunk(&chunks[i]);
+    }
+
+    struct wc_counts total = {0, 0, 0};
+    for (int i = 0; i < n; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+
+        total.lines += chunks[i].counts.lines;
+        total.words += chunks[i].counts.words;
+        total.bytes += chunks[i].counts.bytes;
+
+        if (i > 0 && chunks[i].len > 0 && !scan_is_space(chunks[i].data[0]) &&
+            !scan_is_space(chunks[i].data[-1]))
+            total.words--;
+    }
+
+    return total;
+}
+
+static int count_file(const char* path, struct wc_counts* counts) {
+    struct input in;
+    if (input_open(&in, path) != 0) {
+        print_err("wc: cannot open file: %s\n", path);
+        return -1;
+    }
+
+    counts->lines = 0;
+    counts->words = 0;
+    counts->bytes = 0;
+
+    if (in.map && in.size >= WC_PARALLEL_THRESHOLD) {
+        *counts = count_parallel(in.map, in.size);
+        input_close(&in);
+        return 0;
+    }
+
+    int in_space = 1;
+    const char* data;
+    ssize_t n;
+    while ((n = input_next(&in, &data)) > 0) {
+        counts->lines += scan_count_newlines(data, n);
+        counts->words += scan_count_words(data, n, &in_space);
+        counts->bytes += n;
+    }
+
+    input_close(&in);
+
+    if (n < 0) {
+        print_err("wc: error reading file: %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_counts(const struct wc_counts* counts, const struct wc_flags* flags, const char* name) {
+    if (flags->lines)
+        print(" %7zu", counts->lines);
+    if (flags->words)
+        print(" %7zu", counts->words);
+    if (flags->bytes)
+        print(" %7zu", counts->bytes);
+    print(" %s\n", name);
+}
+
+static struct wc_flags parse_wc_flags(int argc, char* argv[]) {
+    struct wc_flags flags = {0, 0, 0, 1};
+
+    while (flags.file_idx < argc && argv[flags.file_idx][0] == '-') {
+        const char* flag = argv[flags.file_idx] + 1;
+
+        for (int i = 0; flag[i] != '\0'; i++) {
+            if (flag[i] == 'l') {
+                flags.lines = 1;
+            }
+            else if (flag[i] == 'w') {
+                flags.words = 1;
+            }
+            else if (flag[i] == 'c') {
+                flags.bytes = 1;
+            }
+            else {
+                print_err("wc: unknown flag -%s\n", flag);
+                flags.file_idx = -1;
+                return flags;
+            }
+        }
+        flags.file_idx++;
+    }
+
+    if (!flags.lines && !flags.words && !flags.bytes) {
+        flags.lines = 1;
+        flags.words = 1;
+        flags.bytes = 1;
+    }
+
+    return flags;
+}
+
+int builtin_wc(int argc, char* argv[]) {
+    struct wc_flags flags = parse_wc_flags(argc, argv);
+    if (flags.file_idx < 0 || flags.file_idx >= argc) {
+        print_err("usage: wc [-l] [-w] [-c] <file> ...\n");
+        return 0;
+    }
+
+    struct wc_counts total = {0, 0, 0};
+
+    for (int i = flags.file_idx; i < argc; i++) {
+        struct wc_counts counts;
+        if (count_file(argv[i], &counts) != 0)
+            continue;
+
+        print_counts(&counts, &flags, argv[i]);
+        total.lines += counts.lines;
+        total.words += counts.words;
+        total.bytes += counts.bytes;
+    }
+
+    if (argc - flags.file_idx > 1)
+        print_counts(&total, &flags, "total");
+
+    return 0;
+}